@@ -24,6 +24,7 @@ abstract trait CPUParams extends UtilsParams {
   val isZmb        = p(GEN_NAME) == "zmb"
   val isLxb        = p(GEN_NAME) == "lxb"
   val useDifftest  = p(USEDIFFTEST)
+  val useDmaFlush  = p(USEDMAFLUSH) && p(USESLAVE)
   
   def ext(extension: Char): Boolean = extensions.contains(extension)
 }
@@ -39,6 +39,7 @@ object YQConfig {
     case HANDLEMISALIGN   => site(GEN_NAME) match { case "ysyx" => true; case "zmb" => false; case "lxb" => true }
     case USEXILINX        => site(GEN_NAME) match { case "ysyx" => false; case "zmb" => true; case "lxb" => true }
     case USEDIFFTEST      => site(GEN_NAME) match { case "lxb" => true; case _ => false }
+    case USEDMAFLUSH      => false
   }
 
   class CLINT extends MMAP {
@@ -84,3 +85,4 @@ case object USEPLIC          extends Field[Boolean]
 case object USECLINT         extends Field[Boolean]
 case object HANDLEMISALIGN   extends Field[Boolean]
 case object USEDIFFTEST      extends Field[Boolean]
+case object USEDMAFLUSH      extends Field[Boolean]
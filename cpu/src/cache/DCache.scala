@@ -14,6 +14,12 @@ class DCache(implicit p: Parameters) extends YQModule with CacheParams {
     val clintIO = Flipped(new cpu.component.ClintIO)
     val plicIO  = Flipped(new cpu.component.SimplePlicIO)
     val wb      = Flipped(Irrevocable(Bool()))
+    val flush   = if (useDmaFlush) Flipped(Irrevocable(UInt(0.W))) else null // write back and invalidate all, for the simulation DMAC
+    val perf    = if (Debug) Output(new YQBundle {
+      val hit  = Bool()
+      val miss = Bool()
+      val wb   = Bool() // a dirty line handed to the write-back buffer
+    }) else null
   })
 
   private val rand = MaximalPeriodGaloisLFSR(2)
@@ -23,6 +29,8 @@ class DCache(implicit p: Parameters) extends YQModule with CacheParams {
   private val received = RegInit(0.U(LogBurstLen.W))
   private val backAllInnerState = RegInit(0.U(1.W))
   private val writingBackAll = RegInit(0.B)
+  private val invalidating = RegInit(0.B)
+  private val flushValid = if (useDmaFlush) io.flush.valid else 0.B
 
   private val ARVALID = RegInit(0.B)
 
@@ -142,6 +150,7 @@ class DCache(implicit p: Parameters) extends YQModule with CacheParams {
   }
 
   io.wb.ready := 0.B
+  if (useDmaFlush) io.flush.ready := 0.B
   when(state === idle) {
     willDrop := 0.B
     if (isZmb) {
@@ -149,7 +158,7 @@ class DCache(implicit p: Parameters) extends YQModule with CacheParams {
       wdirty := 1.B
       wdata := Fill(BlockSize * 8 / xlen, io.cpuIO.cpuReq.data)
     }
-    when(io.cpuIO.cpuReq.valid) {
+    when(io.cpuIO.cpuReq.valid && !flushValid) {
       state := starting
       when(isPeripheral) { state := passing }
       if (useClint) when(isClint) { state := clint }
@@ -163,7 +172,7 @@ class DCache(implicit p: Parameters) extends YQModule with CacheParams {
           fastReadOK := 0.B
         }
       }
-    }.elsewhen(io.wb.valid) { state := backall; addr := 0.U; way := 0.U; writingBackAll := 1.B }
+    }.elsewhen(io.wb.valid || flushValid) { state := backall; addr := 0.U; way := 0.U; writingBackAll := 1.B; invalidating := flushValid }
   }
   when(state === starting) {
     state := compare
@@ -253,7 +262,12 @@ class DCache(implicit p: Parameters) extends YQModule with CacheParams {
       backAllInnerState := running
       io.wb.ready       := 1.B
       writingBackAll    := 0.B
+      invalidating      := 0.B
       ramDirty.reset
+      if (useDmaFlush) when(invalidating) {
+        io.flush.ready := 1.B
+        ramValid.reset
+      }
     }
   }
   if (useClint) when(state === clint) {
@@ -277,6 +291,15 @@ class DCache(implicit p: Parameters) extends YQModule with CacheParams {
     when(state <= compare) { ARVALID := 0.B; state := idle }
     .otherwise { willDrop := 1.B }
   }
+
+  // only the first compare of a request, a line read back from the
+  // write-back buffer goes through compare again
+  if (Debug) {
+    val firstCompare = state === compare && RegNext(state === starting, 0.B)
+    io.perf.hit  := firstCompare && compareHit
+    io.perf.miss := firstCompare && !compareHit
+    io.perf.wb   := wbBuffer.valid && wbBuffer.ready
+  }
 }
 
 object DCache {
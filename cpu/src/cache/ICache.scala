@@ -14,6 +14,10 @@ class ICache(implicit p: Parameters) extends YQModule with CacheParams {
     val memIO  = new AXI_BUNDLE
     val inv    = Flipped(Irrevocable(Bool()))
     val jmpBch = Input (Bool())
+    val perf   = if (Debug) Output(new YQBundle {
+      val hit  = Bool()
+      val miss = Bool()
+    }) else null
   })
 
   val laIO = if (isLxb) IO(Flipped(new LAIFMMUBundle(6))) else null
@@ -158,6 +162,11 @@ class ICache(implicit p: Parameters) extends YQModule with CacheParams {
     }.elsewhen(revoke && (!passThrough.ready || !io.cpuIO.cpuReq.valid)) { willDrop := 1.B }
   }
   io.cpuIO.cpuResult.fastReady := DontCare
+
+  if (Debug) {
+    io.perf.hit  := state === compare && hit
+    io.perf.miss := state === compare && !compareHit && !revoke
+  }
 }
 
 object ICache {
@@ -19,6 +19,10 @@ class ALU(implicit p: Parameters) extends YQModule {
       val sign = UInt(2.W)
     }))
     val output = Decoupled(SInt(xlen.W))
+    val perf   = if (Debug) Output(new YQBundle {
+      val mulBusy = Bool()
+      val divBusy = Bool()
+    }) else null
   })
   import Operators._
   private val a = io.input.bits.a
@@ -111,6 +115,11 @@ class ALU(implicit p: Parameters) extends YQModule {
   result := Mux1H(operates.map(x => (io.input.bits.op === x._1, x._2)))
 
   when(io.input.bits.word) { io.output.bits := (Fill(32, result(31)) ## result(31, 0)).asSInt }
+
+  if (Debug) {
+    io.perf.mulBusy := !mulTop.io.input.ready
+    io.perf.divBusy := !divTop.io.input.ready
+  }
 }
 
 object Operators {
@@ -18,6 +18,11 @@ abstract class AbstractMMU(implicit p: Parameters) extends YQModule with CachePa
     val priv     = Input (UInt(2.W))
     val jmpBch   = Input (Bool())
     val revAmo   = Output(Bool()) // revoke in-flight amo instruction
+    val perf     = if (Debug) Output(new YQBundle {
+      val itlbMiss = Bool()
+      val dtlbMiss = Bool()
+      val walk     = Bool() // page table walk or A/D update in progress
+    }) else null
   })
 }
 
@@ -60,6 +65,7 @@ class RVMMU(implicit p: Parameters) extends AbstractMMU with CSRsAddr {
   private val dcacheValid = WireDefault(Bool(), io.memIO.pipelineReq.cpuReq.valid)
   private val icacheReady = WireDefault(Bool(), io.icacheIO.cpuResult.ready)
   private val partialInst = RegInit(0.U(16.W))
+  private val (itlbMiss, dtlbMiss) = (WireDefault(0.B), WireDefault(0.B))
 
   when(ifDel) { ifDel := 0.B }; when(memDel) { memDel := 0.B }
   io.revAmo := memDel && memReady && memExcpt
@@ -186,6 +192,7 @@ class RVMMU(implicit p: Parameters) extends AbstractMMU with CSRsAddr {
         when(isU_i && !tlb.isUser(ifVaddr) || isS_i && tlb.isUser(ifVaddr)) { IfRaiseException(12.U, false); io.icacheIO.cpuReq.valid := 0.B } // Instruction page fault
         .elsewhen(!tlb.canExec(ifVaddr)) { IfRaiseException(12.U, false); io.icacheIO.cpuReq.valid := 0.B } // Instruction page fault
       }.elsewhen(!dcacheValid && stage === idle) {
+        itlbMiss := 1.B
         current := ifWalking
         stage := walking
         vaddr := ifVaddr
@@ -203,6 +210,7 @@ class RVMMU(implicit p: Parameters) extends AbstractMMU with CSRsAddr {
         .elsewhen(isWrite && !tlb.isDirty(memVaddr)) { willWalk := 1.B }
       }.otherwise { willWalk := 1.B }
       when(willWalk) {
+        dtlbMiss := 1.B
         current := memWalking
         stage := walking
         vaddr := memVaddr
@@ -250,6 +258,9 @@ class RVMMU(implicit p: Parameters) extends AbstractMMU with CSRsAddr {
                   else io.memIO.pipelineReq.cpuReq.addr(alen - 1, 0)
     io.ifIO.pipelineResult.isMMIO := DontCare
     io.memIO.pipelineResult.isMMIO := memAddr < DRAM.BASE.U && memAddr >= CLINT.BASE.U
+    io.perf.itlbMiss := itlbMiss
+    io.perf.dtlbMiss := dtlbMiss
+    io.perf.walk     := stage =/= idle
   }
 
   private case class IfRaiseException(cause: UInt, isPtw: Boolean = true) {
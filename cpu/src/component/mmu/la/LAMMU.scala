@@ -319,4 +319,6 @@ class LAMMU(implicit p: Parameters) extends AbstractMMU with LACSRsAddr {
     memDel   := 1.B
     memReady := 1.B
   }
+
+  if (Debug) io.perf := 0.U.asTypeOf(io.perf) // TLB refills are taken as exceptions here
 }
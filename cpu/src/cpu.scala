@@ -19,6 +19,7 @@ class CPU(implicit p: Parameters) extends YQModule with CacheParams {
     val master    = new AXI_BUNDLE
     val slave     = if (!isLxb) Flipped(new AXI_BUNDLE) else null
     val interrupt = Input(if (isLxb) UInt(8.W) else Bool())
+    val dmaFlush  = if (useDmaFlush) Flipped(Irrevocable(UInt(0.W))) else null
     val debug     =
     if(Debug)       new DEBUG
     else            null
@@ -91,6 +92,7 @@ class CPU(implicit p: Parameters) extends YQModule with CacheParams {
   moduleMMU.io.jmpBch     <> moduleID.io.jmpBch
   moduleEX.io.invIch      <> moduleICache.io.inv
   moduleEX.io.wbDch       <> moduleDCache.io.wb
+  if (useDmaFlush) moduleDCache.io.flush <> io.dmaFlush
   moduleID.io.jmpBch      <> moduleICache.io.jmpBch
   moduleID.io.mtip        <> (if (useClint) moduleClint.io.mtip else 0.B)
   moduleID.io.msip        <> (if (useClint) moduleClint.io.msip else 0.B)
@@ -169,6 +171,43 @@ class CPU(implicit p: Parameters) extends YQModule with CacheParams {
     io.debug.stval    := moduleCSRs.io.debug.stval
     io.debug.mie      := moduleCSRs.io.debug.mie
     io.debug.mscratch := moduleCSRs.io.debug.mscratch
+
+    def count(event: Bool): UInt = { val c = RegInit(0.U(64.W)); when(event) { c := c + 1.U }; c }
+    val perf     = io.debug.perf
+    val retire   = moduleWB.io.retire
+    val memWait  = moduleMEM.io.dmmu.pipelineReq.cpuReq.valid && !moduleMEM.io.dmmu.pipelineResult.cpuResult.ready
+    val mulDiv   = moduleEX.io.perf.mulBusy || moduleEX.io.perf.divBusy
+    val idStall  = moduleIF .io.nextVR.VALID && !moduleIF .io.nextVR.READY
+    val exStall  = moduleID .io.nextVR.VALID && !moduleID .io.nextVR.READY
+    val memStall = moduleEX .io.nextVR.VALID && !moduleEX .io.nextVR.READY
+    val wbStall  = moduleMEM.io.nextVR.VALID && !moduleMEM.io.nextVR.READY
+    val loadUse  = moduleBypass.io.perf.loadUse
+    perf.cycles     := count(1.B)
+    perf.instrs     := count(retire)
+    perf.icacheHit  := count(moduleICache.io.perf.hit)
+    perf.icacheMiss := count(moduleICache.io.perf.miss)
+    perf.dcacheHit  := count(moduleDCache.io.perf.hit)
+    perf.dcacheMiss := count(moduleDCache.io.perf.miss)
+    perf.dcacheWb   := count(moduleDCache.io.perf.wb)
+    perf.itlbMiss   := count(moduleMMU.io.perf.itlbMiss)
+    perf.dtlbMiss   := count(moduleMMU.io.perf.dtlbMiss)
+    perf.tlbWalk    := count(moduleMMU.io.perf.walk)
+    perf.idStall    := count(idStall)
+    perf.exStall    := count(exStall)
+    perf.memStall   := count(memStall)
+    perf.wbStall    := count(wbStall)
+    perf.loadUse    := count(loadUse)
+    perf.mulBusy    := count(moduleEX.io.perf.mulBusy)
+    perf.divBusy    := count(moduleEX.io.perf.divBusy)
+
+    // A cycle that retires nothing is charged to the oldest reason it could
+    // not: a memory access in MEM, the multiplier or divider, EX holding up
+    // ID (fence.i, sc), a load-use or other operand dependency in ID, or no
+    // instruction coming out of IF. What is left is pipeline refill.
+    val stack = Seq(retire, memWait, mulDiv, exStall, loadUse, moduleID.io.isWait, !moduleIF.io.nextVR.VALID, 1.B)
+    val charged = PriorityEncoderOH(stack)
+    Seq(perf.cpiBase, perf.cpiMemory, perf.cpiMulDiv, perf.cpiExecute,
+        perf.cpiLoadUse, perf.cpiDepend, perf.cpiFrontend, perf.cpiOther).zip(charged).foreach(x => x._1 := count(x._2))
   }
 
   if (useDifftest) {
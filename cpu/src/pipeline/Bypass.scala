@@ -16,6 +16,9 @@ class Bypass(implicit p: Parameters) extends YQModule {
     val isLd   = Input (Bool())
     val isAmo  = Input (Bool())
     val isWait = Output(Bool())
+    val perf   = if (Debug) Output(new YQBundle {
+      val loadUse = Bool() // waiting for a load in EX, a subset of isWait
+    }) else null
   })
 
   private val insCmp = io.instr(1, 0)
@@ -26,6 +29,7 @@ class Bypass(implicit p: Parameters) extends YQModule {
   private val insRsp = Seq(1.U(2.W) ## io.instr(9, 7), 1.U(2.W) ## io.instr(4, 2))
 
   io.isWait := 0.B
+  private val loadUse = WireDefault(0.B)
 
   private val rregs = WireDefault(Vec(32, UInt(xlen.W)), io.rregs)
   for (i <- rregs.indices)
@@ -37,9 +41,11 @@ class Bypass(implicit p: Parameters) extends YQModule {
   (io.receive.rdata zip io.receive.raddr).foreach(x => x._1 := rregs(x._2))
 
   private def willWait(rs: Seq[UInt]): Unit =
-    rs.foreach(x => when((x =/= 0.U || io.isAmo) && (
-                          x === io.idOut.index && io.idOut.valid ||
-                          x === io.exOut.index && io.exOut.valid && io.isLd)) { io.isWait := 1.B })
+    rs.foreach { x =>
+      val onLoad = x === io.exOut.index && io.exOut.valid && io.isLd
+      when((x =/= 0.U || io.isAmo) && (x === io.idOut.index && io.idOut.valid || onLoad)) { io.isWait := 1.B }
+      when((x =/= 0.U || io.isAmo) && onLoad) { loadUse := 1.B }
+    }
 
   private def willWait(rs: UInt): Unit = willWait(Seq(rs))
 
@@ -66,4 +72,6 @@ class Bypass(implicit p: Parameters) extends YQModule {
   when(io.isAmo && (
        io.idOut.valid ||
        io.idOut.index === io.exOut.index && io.exOut.valid && io.isLd)) { io.isWait := 1.B }
+
+  if (Debug) io.perf.loadUse := loadUse
 }
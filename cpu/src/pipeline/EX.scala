@@ -295,6 +295,7 @@ class EX(implicit p: Parameters) extends YQModule {
     io.output.debug.rcsr := rcsr
     io.output.debug.intr := intr
     io.output.debug.rvc  := rvc
+    io.perf := alu.io.perf
   }
 
   if (io.output.diff.isDefined) {
@@ -195,6 +195,10 @@ class EXIO(implicit p: Parameters) extends YQBundle {
   val wbDch  = Irrevocable(UInt(0.W))
   val seip   = Input (Bool())
   val ueip   = Input (Bool())
+  val perf   = if (Debug) Output(new YQBundle {
+    val mulBusy = Bool()
+    val divBusy = Bool()
+  }) else null
 }
 
 class MEMIO(implicit p: Parameters) extends YQBundle {
@@ -31,6 +31,8 @@ object PeripheralConfig {
   class SPIFLASH extends MMAP {
     override val BASE = 0x30000000L
     override val SIZE = 0x10000000L // flash
+    val READ_CMD  = 0x03  // 0x03, 0x0b (fast), 0x3b (dual), 0x6b (quad) or 0xeb (quad I/O)
+    val CONT_READ = false // continuous-read mode, 0xeb only
   }
 
   def apply(): PeripheralConfig = new PeripheralConfig
@@ -34,7 +34,9 @@ module spi_flash
 #( 
 parameter   flash_addr_start = 32'h40000000, 
 parameter   flash_addr_end   = 32'h47ffffff,
-parameter   spi_cs_num       = 2
+parameter   spi_cs_num       = 2,
+parameter   flash_read_cmd   = 8'h03, // 03h, 0Bh, 3Bh, 6Bh or EBh
+parameter   flash_cont_read  = 0      // continuous-read mode, EBh only
 )
 (
   input                      pclk,
@@ -53,6 +55,8 @@ parameter   spi_cs_num       = 2
   output  [spi_cs_num-1:0]   spi_cs,
   output                     spi_mosi,
   input                      spi_miso,
+  output  [3:0]              spi_qmosi,
+  input   [3:0]              spi_qmiso,
   output                     spi_irq_out
 );
 
@@ -82,12 +86,19 @@ reg   [`P_ADDR_W-1:0]    paddr_reg;
 wire  [`P_ADDR_W-1:0]    paddr_in;
 
 wire                     spi_fire;
-wire  [31:0]             spi_tx_data0;
-wire  [31:0]             spi_tx_data1;
-wire  [31:0]             spi_ctl_data;
 
 wire  spi_irq;
 
+reg   [2:0]              xip_state;
+reg   [4:0]              xip_cnt;
+reg                      xip_sclk;
+reg   [39:0]             xip_tx;
+reg   [31:0]             xip_rx;
+reg                      xip_cont;
+wire                     xip_busy;
+wire                     xip_done;
+wire  [31:0]             xip_rdata;
+
 wire [`P_ADDR_W-1:0] paddr_align = {paddr[`P_ADDR_W-1:2], 2'b00};
 
 assign clk         = pclk;
@@ -97,11 +108,7 @@ assign presetn_spi = presetn;
 
 `define CMD_IDLE       5'h0
 `define CMD_SPI_CSR    5'h1
-`define CMD_WR_TXD0    5'h2
-`define CMD_WR_TXD1    5'h3
-`define CMD_WR_CTL     5'h4
-`define CMD_WAIT_IRQ   5'h5
-`define CMD_RD_RXD0    5'h6
+`define CMD_XIP        5'h2
 
 `define SPI_IDLE       5'h0
 `define SPI_ENABLE     5'h1
@@ -124,34 +131,19 @@ assign penable_spi = spi_state == `SPI_ENABLE || spi_state == `SPI_WAIT_READY;
 
 assign spi_irq_out = cmd_state == `CMD_SPI_CSR   ? spi_irq : 1'b0;
 
-assign pwrite_spi = cmd_state == `CMD_SPI_CSR   ? pwrite :
-                    cmd_state == `CMD_RD_RXD0   ? 1'b0   : 1'b1;
-assign pwdata_spi = cmd_state == `CMD_SPI_CSR   ? pwdata : 
-                    cmd_state == `CMD_WR_TXD0   ? spi_tx_data0 : 
-                    cmd_state == `CMD_WR_TXD1   ? spi_tx_data1 :
-                    cmd_state == `CMD_WR_CTL    ? spi_ctl_data : 32'h0;
-
-assign pwstrb_spi = cmd_state == `CMD_SPI_CSR   ? pwstrb : 4'hf; 
+assign pwrite_spi = pwrite;
+assign pwdata_spi = pwdata;
+assign pwstrb_spi = pwstrb;
 
-assign prdata = prdata_spi;
+assign prdata = cmd_state == `CMD_XIP ? xip_rdata : prdata_spi;
 
-assign paddr_spi  = cmd_state == `CMD_SPI_CSR   ? paddr_align[4:0]:
-                    cmd_state == `CMD_WR_TXD0   ? `SPI_ADDR_TXD0  :
-                    cmd_state == `CMD_WR_TXD1   ? `SPI_ADDR_TXD1  :
-                    cmd_state == `CMD_WR_CTL    ? `SPI_ADDR_CTL   :
-                    cmd_state == `CMD_RD_RXD0   ? `SPI_ADDR_RXD0  : 5'h0;
+assign paddr_spi  = cmd_state == `CMD_SPI_CSR   ? paddr_align[4:0] : 5'h0;
 
 assign pready = cmd_state == `CMD_SPI_CSR  && spi_fire || 
-                cmd_state == `CMD_RD_RXD0  && spi_fire; 
+                cmd_state == `CMD_XIP      && xip_done; 
 
 assign pslverr = 1'b0;
 
-assign spi_tx_data1 = 32'h03000000 | paddr_in[23:0]; //addr and readd cmd
-assign spi_tx_data0 = 32'h00000000;   //spi read 32bit data
-assign spi_ctl_data = `SPI_CTL_SS | `SPI_CTL_DIV | `SPI_CTL_RD_ENDIAN | `SPI_CTL_ASS | 
-                      `SPI_CTL_IE | `SPI_CTL_TX_NEGEDGE | `SPI_CTL_GO | `SPI_CTL_CHAR_LEN;
-                      //`SPI_CTL_IE | `SPI_CTL_GO | `SPI_CTL_CHAR_LEN;
-
 always@(posedge clk) begin
   if(!rst_n)
     cmd_state <= `CMD_IDLE;
@@ -159,12 +151,12 @@ always@(posedge clk) begin
     cmd_state <= cmd_state_next;
 end
 
-always@(cmd_state or psel or penable or spi_fire or spi_irq )begin
+always@(cmd_state or psel or penable or spi_fire or xip_done or is_flash or pwrite)begin
   case(cmd_state)
     `CMD_IDLE: begin
       if(psel && penable) begin
         if(is_flash && !pwrite) //read only!!!
-          cmd_state_next = `CMD_WR_TXD0;
+          cmd_state_next = `CMD_XIP;
         else
           cmd_state_next = `CMD_SPI_CSR;
       end
@@ -177,42 +169,93 @@ always@(cmd_state or psel or penable or spi_fire or spi_irq )begin
       else
         cmd_state_next = `CMD_SPI_CSR;
     end
-    `CMD_WR_TXD0:begin
-      if(spi_fire)
-        cmd_state_next = `CMD_WR_TXD1;
-      else
-        cmd_state_next = `CMD_WR_TXD0;
-    end
-    `CMD_WR_TXD1:begin
-      if(spi_fire)
-        cmd_state_next = `CMD_WR_CTL;
+    default:begin //`CMD_XIP
+      if(xip_done)
+        cmd_state_next = `CMD_IDLE;
       else
-        cmd_state_next = `CMD_WR_TXD1;
+        cmd_state_next = `CMD_XIP;
     end
-    `CMD_WR_CTL:begin
-      if(spi_fire)
-        cmd_state_next = `CMD_WAIT_IRQ;
-      else
-        cmd_state_next = `CMD_WR_CTL;
+  endcase
+end
+
+// Flash reads bypass spi_top and are sent by this engine with
+// flash_read_cmd, at half the APB clock. The command, address and mode
+// bits go out from the top of xip_tx, one or four at a time, while SCLK is
+// low, and the data is sampled as SCLK rises, so the flash changes it on
+// the same edges as it does for spi_top. With flash_cont_read, once an EBh
+// read has set the mode bits, the following ones leave out the command.
+`define XIP_IDLE       3'h0
+`define XIP_CMD        3'h1
+`define XIP_ADDR       3'h2
+`define XIP_MODE       3'h3
+`define XIP_DUMMY      3'h4
+`define XIP_DATA       3'h5
+`define XIP_DONE       3'h6
+
+localparam xip_quad_addr = flash_read_cmd == 8'heb;
+localparam xip_width     = flash_read_cmd == 8'h3b ? 2 :
+                           flash_read_cmd == 8'h6b || flash_read_cmd == 8'heb ? 4 : 1;
+localparam xip_dummy     = flash_read_cmd == 8'h03 ? 0 : flash_read_cmd == 8'heb ? 4 : 8;
+localparam xip_mode      = xip_quad_addr && flash_cont_read ? 8'ha0 : 8'h00;
+
+wire [4:0] xip_last = xip_state == `XIP_CMD   ? 5'd7 :
+                      xip_state == `XIP_ADDR  ? (xip_quad_addr ? 5'd5 : 5'd23) :
+                      xip_state == `XIP_MODE  ? 5'd1 :
+                      xip_state == `XIP_DUMMY ? xip_dummy - 1 : 32 / xip_width - 1;
+wire [2:0] xip_next = xip_state == `XIP_CMD   ? `XIP_ADDR :
+                      xip_state == `XIP_ADDR  ? (xip_quad_addr ? `XIP_MODE : xip_dummy == 0 ? `XIP_DATA : `XIP_DUMMY) :
+                      xip_state == `XIP_MODE  ? `XIP_DUMMY :
+                      xip_state == `XIP_DUMMY ? `XIP_DATA : `XIP_DONE;
+wire       xip_wide = xip_state == `XIP_MODE || xip_state == `XIP_ADDR && xip_quad_addr;
+
+assign xip_busy  = xip_state != `XIP_IDLE && xip_state != `XIP_DONE;
+assign xip_done  = xip_state == `XIP_DONE;
+assign xip_rdata = {xip_rx[7:0], xip_rx[15:8], xip_rx[23:16], xip_rx[31:24]};
+
+always@(posedge clk) begin
+  if(!rst_n) begin
+    xip_state <= `XIP_IDLE;
+    xip_cnt   <= 5'd0;
+    xip_sclk  <= 1'b0;
+    xip_tx    <= 40'h0;
+    xip_rx    <= 32'h0;
+    xip_cont  <= 1'b0;
+  end
+  else case(xip_state)
+    `XIP_IDLE: begin
+      if(cmd_state == `CMD_XIP) begin
+        xip_state <= xip_cont ? `XIP_ADDR : `XIP_CMD;
+        xip_tx    <= xip_cont ? {paddr_in[23:0], xip_mode, 8'h0} : {flash_read_cmd[7:0], paddr_in[23:0], xip_mode};
+        xip_cnt   <= 5'd0;
+      end
     end
-    `CMD_WAIT_IRQ:begin
-      if(spi_irq)
-        cmd_state_next = `CMD_RD_RXD0;
-      else
-        cmd_state_next = `CMD_WAIT_IRQ;
+    `XIP_DONE: begin
+      xip_state <= `XIP_IDLE;
+      xip_cont  <= flash_cont_read && xip_quad_addr;
     end
-    default:begin //`CMD_RD_RXD0
-      if(spi_fire)
-        cmd_state_next = `CMD_IDLE;
-      else
-        cmd_state_next = `CMD_RD_RXD0;
+    default: begin
+      xip_sclk <= !xip_sclk;
+      if(!xip_sclk) begin
+        if(xip_state == `XIP_DATA)
+          xip_rx <= xip_width == 4 ? {xip_rx[27:0], spi_qmiso} :
+                    xip_width == 2 ? {xip_rx[29:0], spi_qmiso[1:0]} : {xip_rx[30:0], spi_miso};
+      end
+      else begin
+        xip_tx <= xip_wide ? {xip_tx[35:0], 4'h0} : {xip_tx[38:0], 1'b0};
+        if(xip_cnt == xip_last) begin
+          xip_state <= xip_next;
+          xip_cnt   <= 5'd0;
+        end
+        else
+          xip_cnt <= xip_cnt + 5'd1;
+      end
     end
   endcase
 end
 
 wire spi_apb_start;
 
-assign spi_apb_start = cmd_state != `CMD_IDLE && cmd_state != `CMD_WAIT_IRQ ;
+assign spi_apb_start = cmd_state == `CMD_SPI_CSR;
 
 always@(posedge clk) begin
   if(!rst_n)
@@ -244,8 +287,13 @@ end
 assign spi_fire = spi_state == `SPI_WAIT_READY && pready_spi;
 
 wire [7:0] ss_pad_o;
+wire       spi_top_clk;
+wire       spi_top_mosi;
 
-assign spi_cs = ss_pad_o[1:0];
+assign spi_cs    = xip_busy ? ({spi_cs_num{1'b1}} << 1) : ss_pad_o[spi_cs_num-1:0];
+assign spi_clk   = xip_busy ? xip_sclk : spi_top_clk;
+assign spi_mosi  = xip_busy ? xip_tx[39] : spi_top_mosi;
+assign spi_qmosi = xip_tx[39:36];
 
 spi_top u0_spi_top
 (
@@ -262,8 +310,8 @@ spi_top u0_spi_top
   .PSLVERR(pslverr_spi),
 
   .ss_pad_o(ss_pad_o),
-  .sclk_pad_o(spi_clk),
-  .mosi_pad_o(spi_mosi),
+  .sclk_pad_o(spi_top_clk),
+  .mosi_pad_o(spi_top_mosi),
   .miso_pad_i(spi_miso),
   .IRQ(spi_irq)
 );
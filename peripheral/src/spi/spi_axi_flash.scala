@@ -15,11 +15,15 @@ class SpiAxiFlashIO(implicit val p: Parameters) extends Bundle with PeripheralPa
 
 class spi_axi_flash(implicit val p: Parameters) extends RawModule with PeripheralParams {
   val io = IO(new SpiAxiFlashIO)
+  require(Seq(0x03, 0x0b, 0x3b, 0x6b, 0xeb).contains(SPIFLASH.READ_CMD), f"Unsupported flash read command ${SPIFLASH.READ_CMD}%02xh")
+  require(!SPIFLASH.CONT_READ || SPIFLASH.READ_CMD == 0xeb, "Continuous-read mode needs the EBh read command")
 
   val spiFlash = Module(new spi_flash(Map(
     "flash_addr_start" -> SPIFLASH.BASE,
     "flash_addr_end"   -> (SPIFLASH.BASE + SPIFLASH.SIZE - 1),
-    "spi_cs_num"       -> 1
+    "spi_cs_num"       -> 1,
+    "flash_read_cmd"   -> SPIFLASH.READ_CMD,
+    "flash_cont_read"  -> (if (SPIFLASH.CONT_READ) 1 else 0)
   )))
   val axi2apb  = Module(new Axi2Apb)
 
@@ -38,10 +42,12 @@ class spi_axi_flash(implicit val p: Parameters) extends RawModule with Periphera
   axi2apb.io.apb_m.pslverr := spiFlash.io.pslverr
   axi2apb.io.apb_m.prdata  := spiFlash.io.prdata
 
-  spiFlash.io.spi_miso := io.spi_m.spi_miso
+  spiFlash.io.spi_miso  := io.spi_m.spi_miso
+  spiFlash.io.spi_qmiso := io.spi_m.spi_qmiso
 
   io.spi_m.spi_clk     := spiFlash.io.spi_clk
   io.spi_m.spi_cs      := spiFlash.io.spi_cs
   io.spi_m.spi_irq_out := spiFlash.io.spi_irq_out
   io.spi_m.spi_mosi    := spiFlash.io.spi_mosi
+  io.spi_m.spi_qmosi   := spiFlash.io.spi_qmosi
 }
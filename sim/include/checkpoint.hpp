@@ -0,0 +1,38 @@
+#ifndef __CHECKPOINT_HPP__
+#define __CHECKPOINT_HPP__
+
+#include <stdint.h>
+#include <string.h>
+#include "verilated_save.h"
+
+#define CKPT_PAGE_SIZE 4096
+
+// Only pages holding non-zero bytes are stored, each prefixed by its offset.
+// The list is terminated by an offset equal to the memory size.
+static inline void checkpoint_save_mem(VerilatedSerialize &os, const uint8_t *mem, uint64_t size) {
+  static const uint8_t zero[CKPT_PAGE_SIZE] = {};
+  for (uint64_t off = 0; off < size; off += CKPT_PAGE_SIZE) {
+    uint64_t len = (size - off < CKPT_PAGE_SIZE) ? size - off : CKPT_PAGE_SIZE;
+    if (memcmp(mem + off, zero, len) == 0) continue;
+    os << off;
+    os.write(mem + off, len);
+  }
+  os << size;
+}
+
+// Pages missing from the checkpoint are cleared, but only if they are dirty,
+// so untouched memory is never faulted in.
+static inline void checkpoint_restore_mem(VerilatedDeserialize &os, uint8_t *mem, uint64_t size) {
+  static const uint8_t zero[CKPT_PAGE_SIZE] = {};
+  uint64_t next;
+  os >> next;
+  for (uint64_t off = 0; off < size; off += CKPT_PAGE_SIZE) {
+    uint64_t len = (size - off < CKPT_PAGE_SIZE) ? size - off : CKPT_PAGE_SIZE;
+    if (off == next) {
+      os.read(mem + off, len);
+      os >> next;
+    } else if (memcmp(mem + off, zero, len)) memset(mem + off, 0, len);
+  }
+}
+
+#endif
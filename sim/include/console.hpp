@@ -0,0 +1,28 @@
+#ifndef __CONSOLE_HPP__
+#define __CONSOLE_HPP__
+
+#ifdef CHECKPOINT
+#include "verilated_save.h"
+#endif
+
+// Console shared by the 16550 model (uart.cpp), the TTY model (scanKbd.cpp)
+// and virtio-console (virtio.cpp). Keys are read by one thread into a
+// lock-free ring; the simulation thread is the only consumer. Output takes
+// the opposite way out through a second thread.
+void console_init(void);
+void console_no_input(void);
+void console_set_output(const char *file);
+void console_putc(char ch);
+void console_flush(void);
+void console_mute(void);
+void console_restart(void);
+bool console_empty(void);
+bool console_getc(char *ch);
+void console_inject(const char *str);
+bool console_arrived(void);
+#ifdef CHECKPOINT
+void console_save(VerilatedSerialize &os);
+void console_restore(VerilatedDeserialize &os);
+#endif
+
+#endif
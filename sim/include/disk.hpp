@@ -0,0 +1,106 @@
+#ifndef __DISK_HPP__
+#define __DISK_HPP__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <debug.hpp>
+#ifdef CHECKPOINT
+#include <checkpoint.hpp>
+#endif
+
+#define SECTOR_SIZE 512
+
+// A disk image mapped privately and served a sector at a time. Without an
+// overlay, writes land in that private mapping and are lost at exit. With
+// one, a sector is copied to the overlay file on its first write and read
+// from there afterwards, so the image itself is never written and can be
+// shared by any number of simulations. The overlay is a sparse file of the
+// image size followed by a bitmap of the sectors it holds.
+struct disk_t {
+  uint8_t *data, *overlay, *dirty;
+  uint64_t size, nr_sector;
+};
+
+static inline bool disk_sector_dirty(const disk_t *d, uint64_t n) {
+  return d->dirty[n / 8] & (1 << (n % 8));
+}
+
+static inline uint8_t *disk_sector(disk_t *d, uint64_t n, bool is_write) {
+  if (n >= d->nr_sector) return NULL;
+  uint8_t *p = d->data + n * SECTOR_SIZE;
+  if (!d->overlay) {
+    if (is_write) d->dirty[n / 8] |= 1 << (n % 8);
+    return p;
+  }
+  uint8_t *q = d->overlay + n * SECTOR_SIZE;
+  if (disk_sector_dirty(d, n)) return q;
+  if (!is_write) return p;
+  memcpy(q, p, SECTOR_SIZE);
+  d->dirty[n / 8] |= 1 << (n % 8);
+  return q;
+}
+
+static inline void disk_overlay_init(disk_t *d, const char *file) {
+  uint64_t data_size = (d->size + 4095) & ~4095ULL, size = data_size + (d->nr_sector + 7) / 8;
+  int fd = open(file, O_RDWR | O_CREAT, 0644);
+  Assert(fd >= 0, "Can not open '%s'", file);
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not stat '%s'", file);
+  if (st.st_size == 0) Assert(ftruncate(fd, size) == 0, "Can not size '%s'", file);
+  else Assert((uint64_t)st.st_size == size, "'%s' is not an overlay of this image", file);
+  d->overlay = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Assert(d->overlay != MAP_FAILED, "Can not map '%s'", file);
+  close(fd);
+  d->dirty = d->overlay + data_size;
+  printf(DEBUG "disk writes go to %s\n", file);
+}
+
+// Returns false, leaving `d` empty, if `file` is missing or empty.
+static inline bool disk_open(disk_t *d, const char *file, const char *overlay_file) {
+  memset(d, 0, sizeof(*d));
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+  d->size = st.st_size;
+  d->nr_sector = d->size / SECTOR_SIZE;
+  d->data = (uint8_t *)mmap(NULL, d->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+  Assert(d->data != MAP_FAILED, "Can not map '%s'", file);
+  close(fd);
+  if (overlay_file) disk_overlay_init(d, overlay_file);
+  else d->dirty = (uint8_t *)calloc((d->nr_sector + 7) / 8, 1);
+  return true;
+}
+
+#ifdef CHECKPOINT
+// The written sectors are saved along with the bitmap, so a restore starts
+// from the same disk contents whatever the overlay holds by then.
+static inline void disk_save(VerilatedSerialize &os, disk_t *d) {
+  os << d->nr_sector;
+  if (!d->data) return;
+  checkpoint_save_mem(os, d->dirty, (d->nr_sector + 7) / 8);
+  for (uint64_t n = 0; n < d->nr_sector; n++)
+    if (disk_sector_dirty(d, n)) os.write((d->overlay ? d->overlay : d->data) + n * SECTOR_SIZE, SECTOR_SIZE);
+}
+
+static inline void disk_restore(VerilatedDeserialize &os, disk_t *d) {
+  uint64_t n;
+  os >> n;
+  Assert(n == d->nr_sector, "The checkpoint was saved with a different disk image");
+  if (!d->data) return;
+  checkpoint_restore_mem(os, d->dirty, (d->nr_sector + 7) / 8);
+  for (n = 0; n < d->nr_sector; n++)
+    if (disk_sector_dirty(d, n)) os.read((d->overlay ? d->overlay : d->data) + n * SECTOR_SIZE, SECTOR_SIZE);
+}
+#endif
+
+#endif
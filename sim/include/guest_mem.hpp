@@ -0,0 +1,58 @@
+#ifndef __GUEST_MEM_HPP__
+#define __GUEST_MEM_HPP__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum { HUGEPAGE_NONE, HUGEPAGE_THP, HUGEPAGE_HUGETLB };
+
+#define HUGEPAGE_SIZE (2UL * 1024 * 1024)
+
+// Reserve `size` bytes of zeroed memory. Nothing is committed until it is
+// touched. Falls back to normal pages if no hugetlb pages are available.
+static inline uint8_t *guest_mem_alloc(size_t size, int *hugepage) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  void *p = MAP_FAILED;
+  if (*hugepage == HUGEPAGE_HUGETLB) {
+    // reserved up front, so a short hugetlb pool fails here, not on first touch
+    p = mmap(NULL, (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1), PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+      fprintf(stderr, "no hugetlb pages available, using normal pages\n");
+      *hugepage = HUGEPAGE_NONE;
+    }
+  }
+  if (p == MAP_FAILED) p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+  if (*hugepage == HUGEPAGE_THP) madvise(p, size, MADV_HUGEPAGE);
+  return (uint8_t *)p;
+}
+
+// Place `file` at the page-aligned `mem`. Unless `copy` is set the file is
+// mapped privately on top, so pages are read on first touch and written
+// copy-on-write. Returns the file size, or -1 if it cannot be opened or
+// does not fit in `max` bytes.
+static inline long guest_mem_load(uint8_t *mem, size_t max, const char *file, bool copy) {
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) return -1;
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size > max) {
+    fprintf(stderr, "'%s' does not fit in %ld bytes\n", file, max);
+    close(fd);
+    return -1;
+  }
+  size_t size = st.st_size;
+  if (size && (copy || mmap(mem, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED))
+    for (size_t off = 0; off < size; ) {
+      ssize_t n = pread(fd, mem + off, size - off, off);
+      if (n <= 0) { close(fd); return -1; }
+      off += n;
+    }
+  close(fd);
+  return size;
+}
+
+#endif
@@ -6,8 +6,11 @@
 #include <signal.h>
 #include <errno.h>
 #include <termio.h>
+#include <getopt.h>
 #include <iostream>
 #include <iomanip>
+#include <debug.hpp>
+#include <console.hpp>
 
 #define DEBUG "\33[1;33m[debug]\33[0m "
 
@@ -36,7 +39,9 @@ typedef uint16_t ioaddr_t;
 #define BSIZE  1024  // block size
 #define FSSIZE 1000  // size of file system in blocks
 
-#define PMEM_SIZE (128 * 1024 * 1024 + BSIZE * FSSIZE)
+// Window of guest memory mirrored in the REF, starting at 0x80000000. The
+// DUT side in ram.cpp is larger; accesses outside this window are not checked.
+#define DIFF_PMEM_SIZE (128 * 1024 * 1024 + BSIZE * FSSIZE)
 
 #define SCAN_OR_UART uart
 
@@ -71,19 +76,80 @@ void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction);
 
 #define print_csr(csr) printf("%s = " FMT_WORD "\tspike_%s = " FMT_WORD "\n", #csr, (uint64_t)top->io_##csr, #csr, (uint64_t)diff_regs[csr])
 
+#define DIFF_NR_REG (priv + 1)
+
+// A retired instruction as seen by the DUT, laid out like the regcpy buffer.
+struct diff_commit_t {
+  uint64_t cycle;
+  size_t regs[DIFF_NR_REG];
+  uint16_t rcsr;
+  uint8_t rd;
+  bool skip, intr, rvc;
+};
+
+void difftest_start(bool async, uint64_t sweep);
+diff_commit_t *difftest_next(void);
+bool difftest_commit(void);
+bool difftest_drain(void);
+void difftest_stop(void);
+void difftest_report(void);
+void difftest_dma(uint64_t addr, void *buf, size_t n);
+
 #endif
 
 
 void scan_uart(_init)(void);
+void ram_set_hugepage(int mode);
 void *ram_init(char *img);
+void ram_load(char *img);
+bool ram_loaded(int i, uint64_t *off, uint64_t *size);
+uint8_t *ram_dma(uint64_t addr, uint64_t size);
+
+enum { DRAM_IDEAL, DRAM_FIXED, DRAM_BANK };
+struct dram_config_t { int model, latency, beat, banks, row, row_miss; };
+extern dram_config_t dram_config;
+void dram_init(void);
+void dram_report(void);
+
+void sdcard_set_overlay(const char *file);
 void sdcard_init(char *img);
-extern bool scan_uart(_isRunning);
+void virtio_set_blk(const char *file);
+void virtio_set_blk_overlay(const char *file);
+void virtio_init(void);
+void virtio_poll(void);
+void dmac_set_functional(bool on);
+void dmac_set_latency(int cycles);
 void flash_init(char *img);
 void storage_init(char *img);
 void command_init(const char command[]);
+void uart_poll(void);
+
+void profile_set_output(const char *prefix);
+void profile_set_callgraph(bool on);
+void profile_add_elf(const char *file);
+void profile_commit(uint64_t pc, int rd, uint64_t rd_value, bool rvc);
+void profile_sample(uint64_t pc);
+void profile_write(void);
 
 }
 
+#ifdef CHECKPOINT
+#include "verilated_save.h"
+
+#define CKPT_MAGIC 0x3154504B435159ULL // "YQCKPT1"
+
+void ram_save(VerilatedSerialize &os);
+void ram_restore(VerilatedDeserialize &os);
+void dram_save(VerilatedSerialize &os);
+void dram_restore(VerilatedDeserialize &os);
+void uart_save(VerilatedSerialize &os);
+void uart_restore(VerilatedDeserialize &os);
+void sdcard_save(VerilatedSerialize &os);
+void sdcard_restore(VerilatedDeserialize &os);
+void virtio_save(VerilatedSerialize &os);
+void virtio_restore(VerilatedDeserialize &os);
+#endif
+
 #define ECHOFLAGS (ECHO | ECHOE | ECHOK | ECHONL)
 
 #endif
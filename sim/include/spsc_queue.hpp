@@ -0,0 +1,52 @@
+#ifndef __SPSC_QUEUE_HPP__
+#define __SPSC_QUEUE_HPP__
+
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring. The producer fills a slot
+// in place (alloc + push), the consumer works on it in place (front + pop),
+// so records are never copied through the queue.
+template <typename T, size_t N>
+class spsc_queue {
+  static_assert((N & (N - 1)) == 0, "queue size must be a power of 2");
+
+  T buf[N];
+  alignas(64) std::atomic<size_t> head{0}; // written by the consumer only
+  alignas(64) std::atomic<size_t> tail{0}; // written by the producer only
+
+public:
+  // producer side
+  T *alloc() {
+    size_t t = tail.load(std::memory_order_relaxed);
+    return (t - head.load(std::memory_order_acquire) == N) ? nullptr : &buf[t & (N - 1)];
+  }
+  void push() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+  bool push(const T &v) {
+    T *p = alloc();
+    if (!p) return false;
+    *p = v;
+    push();
+    return true;
+  }
+
+  // consumer side
+  T *front() {
+    size_t h = head.load(std::memory_order_relaxed);
+    return (h == tail.load(std::memory_order_acquire)) ? nullptr : &buf[h & (N - 1)];
+  }
+  void pop() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+  bool pop(T &v) {
+    T *p = front();
+    if (!p) return false;
+    v = *p;
+    pop();
+    return true;
+  }
+  void clear() { head.store(tail.load(std::memory_order_acquire), std::memory_order_release); }
+
+  // either side
+  bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+};
+
+#endif
@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+# Runs one image on differently built simulators, one at a time, and reports
+# the simulated clock cycles per second of each. Each simulator is given as
+# LABEL=PATH, the label being the thread count or the build flavour.
+#
+#   bench.py --max-cycles 20000000 --out build/bench sim/bin/linux-riscv64-nemu.bin \
+#            1=build/sim/obj_dir-t1/VTestTop 4=build/sim/obj_dir-t4/VTestTop -- --dram=fixed
+
+import argparse
+import json
+import os
+import sys
+
+from regress import run_one
+
+
+def main():
+    argv = sys.argv[1:]
+    simflags = []
+    if "--" in argv:
+        simflags = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+
+    parser = argparse.ArgumentParser(description="Compare simulation speed across simulator builds.")
+    parser.add_argument("--max-cycles", type=int, default=20000000, help="clock cycles per run")
+    parser.add_argument("--timeout", type=float, default=0, help="wall-clock seconds per run, 0 for no limit")
+    parser.add_argument("--out", default="bench", help="directory for logs and bench.json")
+    parser.add_argument("image")
+    parser.add_argument("sims", nargs="+", metavar="LABEL=SIM")
+    args = parser.parse_args(argv)
+    args.simflags = simflags
+    os.makedirs(args.out, exist_ok=True)
+
+    runs = []
+    print("%8s %12s %10s %12s %8s" % ("build", "cycles", "seconds", "cycles/s", "speedup"))
+    for x in args.sims:
+        label, args.sim = x.split("=", 1)
+        res = run_one(args, args.image)
+        os.replace(res["log"], os.path.join(args.out, "%s.log" % label))
+        res["log"] = os.path.join(args.out, "%s.log" % label)
+        res["label"] = label
+        runs.append(res)
+        if "sim_hz" not in res:
+            print("%8s %s, see %s" % (label, res["result"], res["log"]))
+            continue
+        base = next(r["sim_hz"] for r in runs if "sim_hz" in r)
+        print("%8s %12d %10.2f %12.0f %7.2fx" % (label, res["cycles"], res["host_seconds"], res["sim_hz"], res["sim_hz"] / base))
+
+    with open(os.path.join(args.out, "bench.json"), "w") as fp:
+        json.dump({"image": args.image, "max_cycles": args.max_cycles, "runs": runs}, fp, indent=2)
+    return 0 if all("sim_hz" in r for r in runs) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,233 @@
+#!/usr/bin/env python3
+# Runs simulation images in parallel and writes a JSON and a JUnit summary.
+#
+#   regress.py --sim build/sim/obj_dir/VTestTop -j 16 --out build/regress \
+#              sim/bin/*-riscv64-nemu.bin -- --dram=fixed
+#
+# Everything after `--` is passed to every run. Each run gets the cycle limit
+# through --max-cycles and reports its numbers through --stats; the wall-clock
+# limit is enforced here. The longest tests of the previous summary in --out
+# are started first, so the slowest one does not end up last.
+#
+# With --server, each job keeps one simulator started with --server and
+# hands it the images one by one, so the model, Spike and the reset are set
+# up once per job instead of once per test.
+
+import argparse
+import json
+import os
+import select
+import signal
+import subprocess
+import sys
+import threading
+import time
+import xml.etree.ElementTree as ET
+from concurrent.futures import ThreadPoolExecutor
+
+SUFFIX = "-riscv64-nemu.bin"
+
+
+def test_name(path):
+    name = os.path.basename(path)
+    return name[:-len(SUFFIX)] if name.endswith(SUFFIX) else os.path.splitext(name)[0]
+
+
+class Server:
+    """A simulator started with --server, running one image at a time."""
+
+    def __init__(self, args):
+        cmd = [args.sim] + args.simflags + ["--server"]
+        if args.max_cycles:
+            cmd.append("--max-cycles=%d" % args.max_cycles)
+        self.proc = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        self.buf = b""
+
+    def alive(self):
+        return self.proc.poll() is None
+
+    def close(self):
+        self.proc.stdin.close()
+        self.proc.wait()
+
+    # Lines other than the replies are the server's own messages.
+    def expect(self, word, deadline):
+        while True:
+            while b"\n" not in self.buf:
+                left = None if deadline is None else deadline - time.monotonic()
+                if left is not None and left <= 0:
+                    raise TimeoutError
+                if not select.select([self.proc.stdout], [], [], left)[0]:
+                    raise TimeoutError
+                data = os.read(self.proc.stdout.fileno(), 4096)
+                if not data:
+                    raise EOFError
+                self.buf += data
+            line, self.buf = self.buf.split(b"\n", 1)
+            fields = line.decode(errors="replace").split()
+            if fields and fields[0] == "error":
+                raise RuntimeError(line.decode(errors="replace"))
+            if len(fields) == 2 and fields[0] == word:
+                return int(fields[1])
+
+    def run(self, image, log, stats, timeout):
+        self.proc.stdin.write(("%s %s %s\n" % (image, log, stats)).encode())
+        self.proc.stdin.flush()
+        pid = self.expect("start", None)
+        try:
+            return self.expect("exit", time.monotonic() + timeout if timeout else None)
+        except TimeoutError:
+            try:
+                os.kill(pid, signal.SIGKILL)
+            except ProcessLookupError:
+                pass  # it exited just now
+            self.expect("exit", None)
+            return None
+
+
+# Never raises, so one broken run cannot stop the summaries from being written.
+def run_one(args, path, server=None):
+    try:
+        return run_test(args, path, server)
+    except Exception as e:
+        name = test_name(path)
+        return {"name": name, "image": path, "log": os.path.join(args.out, name + ".log"), "exit_code": None,
+                "wall_seconds": 0.0, "result": "crashed", "error": repr(e), "passed": False}
+
+
+def run_test(args, path, server):
+    name = test_name(path)
+    log = os.path.join(args.out, name + ".log")
+    stats = os.path.join(args.out, name + ".json")
+    if os.path.exists(stats):
+        os.remove(stats)
+    cmd = [args.sim] + args.simflags + ["--stats=" + stats]
+    if args.max_cycles:
+        cmd.append("--max-cycles=%d" % args.max_cycles)
+    cmd.append(path)
+
+    start = time.monotonic()
+    if server:
+        try:
+            code = server.run(os.path.abspath(path), os.path.abspath(log), os.path.abspath(stats), args.timeout)
+        except (EOFError, BrokenPipeError):
+            code = -1
+    else:
+        with open(log, "w") as fp:
+            proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=fp, stderr=subprocess.STDOUT)
+            try:
+                code = proc.wait(timeout=args.timeout or None)
+            except subprocess.TimeoutExpired:
+                proc.kill()
+                proc.wait()
+                code = None
+    wall = time.monotonic() - start
+
+    res = {"name": name, "image": path, "log": log, "exit_code": code, "wall_seconds": round(wall, 3)}
+    try:
+        with open(stats) as fp:
+            res.update(json.load(fp))
+    except (OSError, ValueError):
+        res["result"] = "crashed"
+    if code is None:
+        res["result"] = "wall-timeout"
+    res["passed"] = code == 0 and res["result"] == "good"
+    return res
+
+
+def load_durations(path):
+    try:
+        with open(path) as fp:
+            return {t["name"]: t["wall_seconds"] for t in json.load(fp)["tests"]}
+    except (OSError, ValueError, KeyError, TypeError):
+        return {}
+
+
+def write_junit(path, summary):
+    suite = ET.Element("testsuite", name="YuQuan", tests=str(len(summary["tests"])),
+                       failures=str(summary["failed"]), time="%.3f" % summary["wall_seconds"])
+    for t in summary["tests"]:
+        case = ET.SubElement(suite, "testcase", classname="sim", name=t["name"], time="%.3f" % t["wall_seconds"])
+        keys = [k for k in ("cycles", "instrs", "ipc", "sim_hz") if k in t]
+        if keys:
+            props = ET.SubElement(case, "properties")
+            for key in keys:
+                ET.SubElement(props, "property", name=key, value=str(t[key]))
+        if not t["passed"]:
+            ET.SubElement(case, "failure", message=t["result"]).text = "see " + t["log"]
+        ET.SubElement(case, "system-out").text = t["log"]
+    ET.ElementTree(suite).write(path, encoding="utf-8", xml_declaration=True)
+
+
+def main():
+    argv = sys.argv[1:]
+    simflags = []
+    if "--" in argv:
+        simflags = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+
+    parser = argparse.ArgumentParser(description="Run simulation images in parallel.")
+    parser.add_argument("--sim", required=True, help="the Verilated simulator")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(), help="runs at a time")
+    parser.add_argument("--max-cycles", type=int, default=0, help="clock cycles per run, 0 for no limit")
+    parser.add_argument("--timeout", type=float, default=0, help="wall-clock seconds per run, 0 for no limit")
+    parser.add_argument("--out", default="regress", help="directory for logs and summaries")
+    parser.add_argument("--server", action="store_true", help="run the images in one fork server per job")
+    parser.add_argument("--json", help="JSON summary (default OUT/summary.json)")
+    parser.add_argument("--junit", help="JUnit summary (default OUT/junit.xml)")
+    parser.add_argument("images", nargs="+")
+    args = parser.parse_args(argv)
+    args.simflags = simflags
+    args.json = args.json or os.path.join(args.out, "summary.json")
+    args.junit = args.junit or os.path.join(args.out, "junit.xml")
+    os.makedirs(args.out, exist_ok=True)
+
+    last = load_durations(args.json)
+    images = sorted(args.images, key=lambda x: -last.get(test_name(x), float("inf")))
+    tty = sys.stdout.isatty()
+    lock = threading.Lock()
+
+    def report(res):
+        with lock:
+            ok = "\33[1;32mpass\33[0m" if tty else "pass"
+            bad = "\33[1;31m%s\33[0m" if tty else "%s"
+            status = ok if res["passed"] else bad % ("fail (%s)" % res["result"])
+            extra = ""
+            if "cycles" in res:
+                extra = "  %d cycles, IPC %.3f, %.0f Hz" % (res["cycles"], res["ipc"], res["sim_hz"])
+            print("[%s] %s%s" % (res["name"], status, extra), flush=True)
+
+    servers = []
+    local = threading.local()
+
+    def run(path):
+        if not args.server:
+            return run_one(args, path)
+        if not getattr(local, "server", None) or not local.server.alive():
+            local.server = Server(args)
+            with lock:
+                servers.append(local.server)
+        return run_one(args, path, local.server)
+
+    start = time.monotonic()
+    with ThreadPoolExecutor(max_workers=max(1, args.jobs)) as pool:
+        futures = [pool.submit(run, x) for x in images]
+        for f in futures:
+            f.add_done_callback(lambda f: report(f.result()))
+        tests = sorted((f.result() for f in futures), key=lambda t: t["name"])
+    for server in servers:
+        if server.alive():
+            server.close()
+
+    failed = sum(not t["passed"] for t in tests)
+    summary = {"passed": len(tests) - failed, "failed": failed,
+               "wall_seconds": round(time.monotonic() - start, 3), "tests": tests}
+    with open(args.json, "w") as fp:
+        json.dump(summary, fp, indent=2)
+    write_junit(args.junit, summary)
+    print("%d passed, %d failed in %.1f s, summary in %s" % (summary["passed"], failed, summary["wall_seconds"], args.json))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
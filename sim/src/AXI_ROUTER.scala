@@ -16,12 +16,13 @@ class AxiRouterIO(implicit val p: Parameters) extends Bundle with SimParams {
   val Zmb_UartIO  = new AXI_BUNDLE
   val Dmac        = new AXI_BUNDLE
   val SdIO        = new AXI_BUNDLE
+  val VirtioIO    = new AXI_BUNDLE
 }
 
 class ROUTER(implicit val p: Parameters) extends RawModule with SimParams {
   val io = IO(new AxiRouterIO)
 
-  val dram::uart::spiflash::nemu_uart::zmb_uart::dmac::sd_card::Nil = Enum(7)
+  val dram::uart::spiflash::nemu_uart::zmb_uart::dmac::sd_card::virtio::Nil = Enum(8)
 
   for (i <- 2 until io.getElements.length) {
     val devIO = io.getElements.reverse(i).asInstanceOf[AXI_BUNDLE]
@@ -95,6 +96,7 @@ class ROUTER(implicit val p: Parameters) extends RawModule with SimParams {
     AddDevice(zmb_uart, ZMB_UART, io.Zmb_UartIO)
     AddDevice(dmac, DMAC, io.Dmac)
     AddDevice(sd_card, SD_CARD, io.SdIO)
+    AddDevice(virtio, VIRTIO, io.VirtioIO)
 
     when(io.input.r.fire) {
       when(io.input.r.bits.last) {
@@ -1,12 +1,22 @@
 package sim.top
 
 import chipsalliance.rocketchip.config.Parameters
+import peripheral.{PeripheralConfig, SPIFLASH_MMAP}
 
 object Elaborate extends App {
   implicit var p: Parameters = (new sim.SimConfig).alter(cpu.cache.CacheConfig.f).alterPartial({ case cpu.GEN_NAME => if (args.contains("zmb")) "zmb" else "ysyx" })
 
   if (args.contains("FLASH")) p = p.alterPartial({ case cpu.USEFLASH => true })
 
+  private def arg(name: String) = args.find(_.startsWith(name + "=")).map(_.drop(name.length + 1))
+  if (arg("FLASH_READ").nonEmpty || arg("FLASH_CONT").nonEmpty) {
+    val flash = p(SPIFLASH_MMAP)
+    p = p.alterPartial({ case SPIFLASH_MMAP => new PeripheralConfig.SPIFLASH {
+      override val READ_CMD  = arg("FLASH_READ").map(Integer.parseInt(_, 16)).getOrElse(flash.READ_CMD)
+      override val CONT_READ = arg("FLASH_CONT").map(_ == "1").getOrElse(flash.CONT_READ)
+    }})
+  }
+
   val targetParams = if (args.contains("HW"))
     Array("--target", "hw")
   else
@@ -30,10 +30,11 @@ object SimConfig {
     case NEMU_UART_MMAP   => new NEMU_UART
     case ZMB_UART_MMAP    => new ZMB_UART
     case SD_CARD_MMAP     => new SD_CARD
+    case VIRTIO_MMAP      => new VIRTIO
     case CLINT_MMAP       => new YQConfig.CLINT
     case DRAM_MMAP        => new YQConfig.DRAM
     case SPI_MMAP         => new PeripheralConfig.SPI
-    case SPIFLASH_MMAP    => new PeripheralConfig.SPIFLASH
+    case SPIFLASH_MMAP    => new SPIFLASH
     case MODULE_PREFIX    => s""
     case REG_CONF         => new YQConfig.RegConf(3, 10, 4)
     case ENABLE_DEBUG     => true
@@ -45,6 +46,7 @@ object SimConfig {
     case HANDLEMISALIGN   => site(GEN_NAME) match { case "ysyx" => true; case "zmb" => false }
     case USEXILINX        => site(GEN_NAME) match { case "ysyx" => false; case "zmb" => true }
     case USEDIFFTEST      => false
+    case USEDMAFLUSH      => site(GEN_NAME) match { case "ysyx" => true; case "zmb" => false }
     case USEFLASH         => false
   }
 
@@ -62,6 +64,11 @@ object SimConfig {
     val DMAC_STATUS_REG = BASE + 24
   }
 
+  class SPIFLASH extends PeripheralConfig.SPIFLASH {
+    override val READ_CMD  = 0xeb
+    override val CONT_READ = true
+  }
+
   class NEMU_UART extends MMAP {
     override val BASE = 0x02010000L
     override val SIZE = 0x1L
@@ -72,6 +79,11 @@ object SimConfig {
     override val SIZE = 0x1000L
   }
 
+  class VIRTIO extends MMAP {
+    override val BASE = 0x10001000L
+    override val SIZE = 0x2000L
+  }
+
   class ZMB_UART extends MMAP {
     override val BASE = 0x40600000L
     override val SIZE = 0x1000L
@@ -84,4 +96,5 @@ case object DMAC_MMAP      extends Field[SimConfig.DMAC]
 case object NEMU_UART_MMAP extends Field[SimConfig.NEMU_UART]
 case object SD_CARD_MMAP   extends Field[SimConfig.SD_CARD]
 case object UART_MMAP      extends Field[SimConfig.UART]
+case object VIRTIO_MMAP    extends Field[SimConfig.VIRTIO]
 case object ZMB_UART_MMAP  extends Field[SimConfig.ZMB_UART]
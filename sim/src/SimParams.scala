@@ -13,6 +13,7 @@ abstract trait SimParams extends CPUParams with PeripheralParams {
   val ZMB_UART    = p(ZMB_UART_MMAP)
   val SD_CARD     = p(SD_CARD_MMAP)
   val UART        = p(UART_MMAP)
+  val VIRTIO      = p(VIRTIO_MMAP)
 
   override val SPI      = p(SPI_MMAP)
   override val SPIFLASH = p(SPIFLASH_MMAP)
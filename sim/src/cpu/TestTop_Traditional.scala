@@ -1,6 +1,7 @@
 package sim.cpu
 
 import chisel3._
+import chisel3.util.Arbiter
 import chipsalliance.rocketchip.config._
 
 import utils._
@@ -14,6 +15,7 @@ import peripheral.uart._
 import peripheral.spiFlash._
 import peripheral.dmac._
 import peripheral.sdcard._
+import peripheral.virtio._
 
 class TestTop_Traditional(io: DEBUG, clock: Clock, reset: Reset)(implicit val p: Parameters) extends SimParams {
   val cpu       = Module(new CPU)
@@ -21,6 +23,7 @@ class TestTop_Traditional(io: DEBUG, clock: Clock, reset: Reset)(implicit val p:
   val uart      = Module(new UartSim)
   val spi       = Module(new AxiFlash)
   val sd        = Module(new SDCard)
+  val virtio    = Module(new Virtio)
   val nemu_uart = Module(new Nemu_Uart)
   val zmb_uart  = Module(new Zmb_Uart)
   val dmac      = Module(new DMAC)
@@ -30,6 +33,13 @@ class TestTop_Traditional(io: DEBUG, clock: Clock, reset: Reset)(implicit val p:
 
   cpu.io.master <> router.io.input
   cpu.io.slave  <> dmac.io.toCPU
+  if (useDmaFlush) {
+    val flush = Module(new Arbiter(UInt(0.W), 3)) // DCache write-back and invalidate, for the DMA engines
+    flush.io.in(0) <> dmac.io.flush
+    flush.io.in(1) <> virtio.io.flush
+    flush.io.in(2) <> sd.io.flush
+    cpu.io.dmaFlush <> flush.io.out
+  }
 
   router.io.DramIO      <> mem.io.channel
   router.io.UartIO      <> uart.io.channel
@@ -38,8 +48,9 @@ class TestTop_Traditional(io: DEBUG, clock: Clock, reset: Reset)(implicit val p:
   router.io.Zmb_UartIO  <> zmb_uart.io.channel
   router.io.Dmac        <> dmac.io.fromCPU.channel
   router.io.SdIO        <> sd.io.channel
+  router.io.VirtioIO    <> virtio.io.channel
 
-  cpu.io.interrupt  := uart.io.interrupt
+  cpu.io.interrupt  := uart.io.interrupt || sd.io.interrupt || virtio.io.interrupt
 
   mem.io.basic.ACLK             := clock
   mem.io.basic.ARESETn          := !reset.asBool
@@ -55,6 +66,8 @@ class TestTop_Traditional(io: DEBUG, clock: Clock, reset: Reset)(implicit val p:
   dmac.io.fromCPU.basic.ARESETn := !reset.asBool
   sd.io.basic.ACLK              := clock
   sd.io.basic.ARESETn           := !reset.asBool
+  virtio.io.basic.ACLK          := clock
+  virtio.io.basic.ARESETn       := !reset.asBool
   router.io.basic.ACLK          := clock
   router.io.basic.ARESETn       := !reset.asBool
 }
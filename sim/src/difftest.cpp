@@ -0,0 +1,171 @@
+#ifdef DIFFTEST
+
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <atomic>
+#include <sim_main.hpp>
+#include <spsc_queue.hpp>
+
+#define DIFF_QUEUE_SIZE 4096
+
+static const char *csr_name[] = {
+  "pc", "mstatus", "mepc", "sepc", "mtvec", "stvec", "mcause",
+  "scause", "mtval", "stval", "mie", "mscratch", "priv"
+};
+
+// same order as the original per-commit checks, GPRs come last
+static const int csr_check[] = { mtval, stval, mcause, scause, mepc, sepc, mstatus, mtvec, stvec, mie, mscratch, priv };
+
+static size_t diff_regs[50];
+static diff_commit_t sync_commit, failed_commit;
+static int failed_reg = -1;
+
+// With a sweep interval set, a commit that leaves every CSR untouched only
+// has its destination GPR compared. The full state is still compared every
+// `sweep` commits and on anything that changes a CSR (traps, xRET, CSR ops).
+static uint64_t sweep = 0, since_sweep = 0;
+static size_t last_csrs[DIFF_NR_REG - mstatus];
+
+static bool async_mode = false;
+static pthread_t thread_check;
+static spsc_queue<diff_commit_t, DIFF_QUEUE_SIZE> commits;
+static std::atomic<bool> failed{false};
+static std::atomic<bool> checker_running{false};
+
+// Bring the REF in line with a skipped commit, with a regcpy round trip so
+// that the entries the DUT does not report keep the values of the REF.
+static void difftest_sync(const diff_commit_t &c, size_t next_pc) {
+  size_t tmp[50];
+  difftest_regcpy(tmp, DIFFTEST_TO_DUT);
+  memcpy(tmp, c.regs, sizeof(c.regs));
+  tmp[pc] = next_pc;
+  difftest_regcpy(tmp, DIFFTEST_TO_REF);
+}
+
+static bool difftest_check(const diff_commit_t &c) {
+  if (c.regs[pc] != diff_gpr_pc.pc[0]) {
+    failed_reg = pc;
+    return true;
+  }
+  uint64_t csr_mask = 0;
+  for (int i = mstatus; i < DIFF_NR_REG; i++)
+    if (last_csrs[i - mstatus] != c.regs[i]) {
+      last_csrs[i - mstatus] = c.regs[i];
+      csr_mask |= 1ULL << i;
+    }
+  if (!c.skip) {
+    difftest_exec(1);
+    if (sweep && ++since_sweep < sweep && !csr_mask && c.rcsr == 0xFFF) {
+      if (c.regs[c.rd] != diff_gpr_pc.gpr[c.rd]) { failed_reg = c.rd; return true; }
+      return false;
+    }
+    since_sweep = 0;
+    difftest_regcpy(diff_regs, DIFFTEST_TO_DUT);
+    for (int reg : csr_check)
+      if (diff_regs[reg] != c.regs[reg]) { failed_reg = reg; return true; }
+    for (int i = 0; i < 32; i++)
+      if (diff_regs[i] != c.regs[i]) { failed_reg = i; return true; }
+  } else {
+    // Spike still steps over the skipped instruction. Afterwards it can only
+    // disagree in the PC, the destination GPR and the CSRs the DUT changed,
+    // so the sync is left out when none of them differ.
+    size_t next_pc = c.intr ? (c.regs[priv] == 0b11 ? c.regs[mtvec] : c.regs[stvec]) : c.regs[pc] + (c.rvc ? 2 : 4);
+    if (!c.intr) difftest_exec(1);
+    if (csr_mask || diff_gpr_pc.pc[0] != next_pc || diff_gpr_pc.gpr[c.rd] != c.regs[c.rd]) difftest_sync(c, next_pc);
+  }
+  return false;
+}
+
+static void fail(const diff_commit_t &c) {
+  failed_commit = c;
+  difftest_regcpy(diff_regs, DIFFTEST_TO_DUT);
+  failed.store(true, std::memory_order_release);
+}
+
+static void *checker(void *) {
+  while (checker_running) {
+    diff_commit_t *c = commits.front();
+    if (!c) {
+      sched_yield();
+      continue;
+    }
+    if (difftest_check(*c)) {
+      fail(*c);
+      commits.clear();
+      break;
+    }
+    commits.pop();
+  }
+  return NULL;
+}
+
+void difftest_start(bool async, uint64_t sweep_interval) {
+  sweep = sweep_interval;
+  if (sweep) printf(DEBUG "Difftest compares the full state every %ld commits.\n", sweep);
+  async_mode = async;
+  if (!async) return;
+  checker_running = true;
+  pthread_create(&thread_check, NULL, checker, NULL);
+  printf(DEBUG "Difftest runs on a separate thread.\n");
+}
+
+diff_commit_t *difftest_next() {
+  if (!async_mode) return &sync_commit;
+  diff_commit_t *c;
+  while (!(c = commits.alloc())) {
+    if (failed.load(std::memory_order_acquire)) return &sync_commit; // dropped, checker stopped
+    sched_yield();
+  }
+  return c;
+}
+
+bool difftest_commit() {
+  if (async_mode) {
+    if (failed.load(std::memory_order_acquire)) return true;
+    commits.push();
+    return false;
+  }
+  if (!difftest_check(sync_commit)) return false;
+  fail(sync_commit);
+  return true;
+}
+
+bool difftest_drain() {
+  if (!async_mode) return failed.load(std::memory_order_relaxed);
+  // a record is popped only after it has been checked
+  while (!failed.load(std::memory_order_acquire) && !commits.empty())
+    sched_yield();
+  return failed.load(std::memory_order_acquire);
+}
+
+void difftest_stop() {
+  if (!async_mode || !checker_running) return;
+  checker_running = false;
+  pthread_join(thread_check, NULL);
+}
+
+// A device wrote guest memory by DMA. Once every earlier commit has been
+// checked, the same bytes are copied to the REF.
+void difftest_dma(uint64_t addr, void *buf, size_t n) {
+  difftest_drain();
+  if (addr < 0x80000000UL || addr - 0x80000000UL >= DIFF_PMEM_SIZE) return;
+  if (n > DIFF_PMEM_SIZE - (addr - 0x80000000UL)) n = DIFF_PMEM_SIZE - (addr - 0x80000000UL);
+  difftest_memcpy(addr, buf, n, DIFFTEST_TO_REF);
+}
+
+void difftest_report() {
+  const diff_commit_t &c = failed_commit;
+  const size_t *dut = c.regs;
+  std::cout << DEBUG "Exit after " << c.cycle / 2 << " clock cycles.\n";
+  if (failed_reg < 32) printf(DEBUG "\33[1;31mGPR[%d] Diff\33[0m ", failed_reg);
+  else printf(DEBUG "\33[1;31m%s Diff\33[0m ", csr_name[failed_reg - pc]);
+  printf("at pc = " FMT_WORD "\n" DEBUG, dut[pc]);
+  printf("pc = " FMT_WORD "\tspike_pc = " FMT_WORD "\n", dut[pc], diff_regs[pc]);
+  for (int i = 0; i < 32; i++)
+    printf("GPR[%d] = " FMT_WORD "\tspike_GPR[%d] = " FMT_WORD "\n", i, dut[i], i, diff_regs[i]);
+  for (int i = mstatus; i < DIFF_NR_REG; i++)
+    printf("%s = " FMT_WORD "\tspike_%s = " FMT_WORD "\n", csr_name[i - pc], dut[i], csr_name[i - pc], diff_regs[i]);
+}
+
+#endif
@@ -7,10 +7,47 @@ import chipsalliance.rocketchip.config._
 import utils._
 import sim._
 
+// Runs the transfer in dmac.cpp instead, with `--dmac=functional`.
+class DmacCopy(implicit val p: Parameters) extends BlackBox with HasBlackBoxInline with SimParams {
+  val io = IO(new Bundle {
+    val clock      = Input (Clock())
+    val start      = Input (Bool())
+    val src        = Input (UInt(64.W))
+    val dst        = Input (UInt(64.W))
+    val beats      = Input (UInt(32.W))
+    val functional = Output(Bool())
+    val latency    = Output(UInt(32.W))
+  })
+
+  setInline("DmacCopy.v", s"""
+    |import "DPI-C" function bit dmac_functional();
+    |import "DPI-C" function int dmac_copy(input longint src, input longint dst, input int beats);
+    |
+    |module DmacCopy (
+    |  input  clock,
+    |  input  start,
+    |  input  [63:0] src,
+    |  input  [63:0] dst,
+    |  input  [31:0] beats,
+    |  output reg functional,
+    |  output reg [31:0] latency
+    |);
+    |
+    |  initial functional = dmac_functional();
+    |
+    |  always@(posedge clock) begin
+    |    if (start) latency <= dmac_copy(src, dst, beats);
+    |  end
+    |
+    |endmodule
+  """.stripMargin)
+}
+
 class DMAC(implicit val p: Parameters) extends RawModule with SimParams {
   val io = IO(new Bundle {
     val toCPU    = new AXI_BUNDLE
     val fromCPU  = new AxiSlaveIO
+    val flush    = if (useDmaFlush) Irrevocable(UInt(0.W)) else null // write back and invalidate the DCache
   })
 
   dontTouch(io)
@@ -29,11 +66,45 @@ class DMAC(implicit val p: Parameters) extends RawModule with SimParams {
     fifo.io.deq.ready := io.toCPU.w.fire
 
     val toCPU    = new ToCPU(io.toCPU, fifo.io, regFree, regWAddr, regRAddr)
-    val fromCPU  = new FromCPU(io.fromCPU.channel, toCPU, regRAddr, regWAddr, regTransLen, regFree)
+    val fromCPU  = new FromCPU(io.fromCPU.channel, regRAddr, regWAddr, regTransLen, regFree)
+
+    if (useDmaFlush) {
+      // Functional mode: once the DCache holds nothing of either range, copy
+      // at once and report free after the modeled latency. A latency of all
+      // ones means a range is not in DRAM, and the bursts are run instead.
+      val copy = Module(new DmacCopy)
+      val flushing = RegInit(0.B)
+      val loading  = RegNext(io.flush.fire, 0.B)
+      val counting = RegInit(0.B)
+      val counter  = RegInit(0.U(32.W))
+      copy.io.clock := io.fromCPU.basic.ACLK
+      copy.io.start := io.flush.fire
+      copy.io.src   := regRAddr
+      copy.io.dst   := regWAddr
+      copy.io.beats := regTransLen
+      io.flush.valid := flushing
+      io.flush.bits  := DontCare
+
+      when(fromCPU.start) {
+        when(copy.io.functional) { flushing := 1.B }.otherwise { toCPU.start(regTransLen) }
+      }
+      when(io.flush.fire) { flushing := 0.B }
+      when(loading) {
+        when(copy.io.latency.andR) { toCPU.start(regTransLen) }.otherwise {
+          counter  := copy.io.latency
+          counting := 1.B
+        }
+      }.elsewhen(counting) {
+        when(counter === 0.U) {
+          counting := 0.B
+          regFree  := 1.B
+        }.otherwise { counter := counter - 1.U }
+      }
+    } else when(fromCPU.start) { toCPU.start(regTransLen) }
   }
 }
 
-private class FromCPU(fromCPU: AXI_BUNDLE, toCPU: ToCPU, rAddr: UInt, wAddr: UInt, transLen: UInt, free: Bool)(implicit val p: Parameters) extends SimParams {
+private class FromCPU(fromCPU: AXI_BUNDLE, rAddr: UInt, wAddr: UInt, transLen: UInt, free: Bool)(implicit val p: Parameters) extends SimParams {
   val AWREADY = RegInit(1.B); fromCPU.aw.ready := AWREADY
   val WREADY  = RegInit(0.B); fromCPU.w .ready := WREADY
   val BVALID  = RegInit(0.B); fromCPU.b .valid := BVALID
@@ -44,6 +115,7 @@ private class FromCPU(fromCPU: AXI_BUNDLE, toCPU: ToCPU, rAddr: UInt, wAddr: UIn
   val BID    = RegInit(0.U(idlen.W)); fromCPU.b.bits.id := BID
   val AWADDR = RegInit(0.U(alen.W))
   val RDATA  = RegInit(0.U(xlen.W)); fromCPU.r.bits.data := RDATA
+  val start  = WireDefault(0.B)
 
   val wireRawRData = WireDefault(0.U(32.W))
   val wireWData = fromCPU.w.bits.data
@@ -77,12 +149,8 @@ private class FromCPU(fromCPU: AXI_BUNDLE, toCPU: ToCPU, rAddr: UInt, wAddr: UIn
       is(DMAC.WRITE_ADDR_REG.U)  { wAddr  := wireWData }
       is(DMAC.TRANS_LENTH_REG.U) { transLen := wireWData }
       is(DMAC.DMAC_STATUS_REG.U) {
-        free := 0.B
-        toCPU.originLen := transLen - 1.U
-        toCPU.len       := transLen - 1.U
-        toCPU.ARVALID   := 1.B
-        toCPU.AWVALID   := 1.B
-        toCPU.WVALID    := 1.B
+        free  := 0.B
+        start := 1.B
       }
   }
     WREADY := 0.B
@@ -112,6 +180,14 @@ private class ToCPU(toCPU: AXI_BUNDLE, fifo: QueueIO[UInt], free: Bool, wAddr: U
   val len = RegInit(0.U(32.W))
   val wireWLAST = WireDefault(0.B)
 
+  def start(transLen: UInt): Unit = {
+    originLen := transLen - 1.U
+    len       := transLen - 1.U
+    ARVALID   := 1.B
+    AWVALID   := 1.B
+    WVALID    := 1.B
+  }
+
   when(toCPU.aw.fire) {
     AWVALID := 0.B
     BREADY  := 1.B
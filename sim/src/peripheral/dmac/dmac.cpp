@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <svdpi.h>
+#include <debug.hpp>
+#include <sim_main.hpp>
+
+// In the functional mode a transfer is a single memmove on guest memory,
+// done once the DCache has been written back and invalidated, and finished
+// `latency` cycles later. A range outside DRAM is left to the AXI bursts
+// instead, so it fails the same way as without the functional mode.
+static bool functional = false;
+static int latency = 0;
+
+extern "C" {
+
+void dmac_set_functional(bool on) { functional = on; }
+void dmac_set_latency(int cycles) {
+  Assert(cycles >= 0, "The DMAC latency can not be negative");
+  latency = cycles;
+}
+
+svBit dmac_functional() {
+  if (functional) printf(DEBUG "DMAC transfers are done functionally, %d cycles each\n", latency);
+  return functional;
+}
+
+int dmac_copy(long long src, long long dst, int beats) {
+  uint64_t n = (uint64_t)(uint32_t)beats * 8;
+  uint8_t *s = ram_dma(src, n), *d = ram_dma(dst, n);
+  if (!s || !d) return -1; // DMAC.scala starts the AXI transfer
+  memmove(d, s, n);
+#ifdef DIFFTEST
+  difftest_dma(dst, d, n);
+#endif
+  return latency;
+}
+
+}
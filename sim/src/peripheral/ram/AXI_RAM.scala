@@ -6,59 +6,168 @@ import chipsalliance.rocketchip.config._
 
 import utils._
 import sim._
+import cpu.cache.BURST_LEN
 
-class RamRead extends BlackBox with HasBlackBoxInline {
+// A burst of up to `beats` beats is read by a single DPI call when it is
+// accepted and then handed out beat by beat, so the R channel timing is the
+// same as reading each beat on its own. Longer bursts and single beats still
+// go through ram_read.
+class RamRead(beats: Int) extends BlackBox with HasBlackBoxInline {
   val io = IO(new Bundle {
     val clock = Input (Clock())
+    val start = Input (Bool())
+    val next  = Input (Bool())
     val addr  = Input (UInt(64.W))
+    val size  = Input (UInt(3.W))
+    val len   = Input (UInt(8.W))
     val data  = Output(UInt(64.W))
   })
 
   setInline("RamRead.v",s"""
     |import "DPI-C" function longint ram_read(input longint addr);
+    |import "DPI-C" function void ram_read_burst(input longint addr, input byte size, input byte len, output bit [${beats * 64 - 1}:0] data);
     |
     |module RamRead (
     |  input  clock,
+    |  input  start,
+    |  input  next,
     |  input  [63:0] addr,
-    |  output reg [63:0] data
+    |  input  [ 2:0] size,
+    |  input  [ 7:0] len,
+    |  output [63:0] data
     |);
     |
+    |  reg [${beats * 64 - 1}:0] line;
+    |  reg [63:0] word;
+    |  reg [ 7:0] beat;
+    |  reg direct;
+    |
     |  always@(posedge clock) begin
-    |    data <= ram_read(addr);
+    |    if (start) begin
+    |      beat <= 0;
+    |      direct <= len == 0 || len >= ${beats};
+    |      if (len == 0 || len >= ${beats}) word <= ram_read(addr);
+    |      else ram_read_burst(addr, {5'b0, size}, len, line);
+    |    end else if (next) begin
+    |      beat <= beat + 1;
+    |      if (direct) word <= ram_read(addr);
+    |    end
     |  end
     |
+    |  assign data = direct ? word : line[beat * 64 +: 64];
+    |
     |endmodule
   """.stripMargin)
 }
 
-class RamWrite extends BlackBox with HasBlackBoxInline {
+// Beats of a burst of up to `beats` beats are collected and written by a
+// single DPI call on the last one, which is before B is sent.
+class RamWrite(beats: Int) extends BlackBox with HasBlackBoxInline {
   val io = IO(new Bundle {
     val clock = Input (Clock())
     val wen   = Input (Bool())
     val addr  = Input (UInt(64.W))
+    val size  = Input (UInt(3.W))
+    val len   = Input (UInt(8.W))
     val data  = Input (UInt(64.W))
     val mask  = Input (UInt(8.W))
   })
 
   setInline("RamWrite.v",s"""
     |import "DPI-C" function void ram_write(input longint addr, input longint data, input byte mask);
+    |import "DPI-C" function void ram_write_burst(input longint addr, input byte size, input byte len, input bit [${beats * 64 - 1}:0] data, input bit [${beats * 8 - 1}:0] mask);
     |
     |module RamWrite (
     |  input  clock,
     |  input  wen,
     |  input  [63:0] addr,
+    |  input  [ 2:0] size,
+    |  input  [ 7:0] len,
     |  input  [63:0] data,
     |  input  [ 7:0] mask
     |);
     |
+    |  reg [${beats * 64 - 1}:0] line;
+    |  reg [${beats * 8 - 1}:0] strb;
+    |  reg [63:0] base;
+    |  reg [ 7:0] beat;
+    |  reg direct;
+    |
+    |  initial beat = 0;
+    |
     |  always@(posedge clock) begin
-    |    if (wen) ram_write(addr, data, mask);
+    |    if (wen) begin
+    |      if (beat == 0) begin
+    |        base = addr;
+    |        direct = len == 0 || len >= ${beats};
+    |      end
+    |      if (direct) ram_write(addr, data, mask);
+    |      else begin
+    |        line[beat * 64 +: 64] = data;
+    |        strb[beat * 8 +: 8] = mask;
+    |        if (len == 0) ram_write_burst(base, {5'b0, size}, beat, line, strb);
+    |      end
+    |      beat <= len == 0 ? 0 : beat + 1;
+    |    end
     |  end
     |
     |endmodule
   """.stripMargin)
 }
 
+// Holds back the response of a burst as long as the DRAM timing model in
+// dram.cpp says. `first` covers the first R beat or B, `beat` every beat
+// after that; both are zero with the default ideal model.
+class RamTiming extends BlackBox with HasBlackBoxInline {
+  val io = IO(new Bundle {
+    val clock = Input (Clock())
+    val start = Input (Bool())
+    val write = Input (Bool())
+    val id    = Input (UInt(8.W))
+    val addr  = Input (UInt(64.W))
+    val len   = Input (UInt(8.W))
+    val beat  = Input (Bool())
+    val first_wait = Output(Bool())
+    val beat_wait  = Output(Bool())
+  })
+
+  setInline("RamTiming.v",s"""
+    |import "DPI-C" function int ram_timing(input bit write, input byte id, input longint addr, input byte len, output int beat);
+    |
+    |module RamTiming (
+    |  input  clock,
+    |  input  start,
+    |  input  write,
+    |  input  [ 7:0] id,
+    |  input  [63:0] addr,
+    |  input  [ 7:0] len,
+    |  input  beat,
+    |  output first_wait,
+    |  output beat_wait
+    |);
+    |
+    |  reg [31:0] first_cnt, beat_cnt, beat_cycles;
+    |
+    |  initial begin
+    |    first_cnt = 0;
+    |    beat_cnt = 0;
+    |    beat_cycles = 0;
+    |  end
+    |
+    |  always@(posedge clock) begin
+    |    if (start) first_cnt <= ram_timing(write, id, addr, len, beat_cycles);
+    |    else if (first_cnt != 0) first_cnt <= first_cnt - 1;
+    |    if (beat) beat_cnt <= beat_cycles;
+    |    else if (beat_cnt != 0) beat_cnt <= beat_cnt - 1;
+    |  end
+    |
+    |  assign first_wait = first_cnt != 0;
+    |  assign beat_wait  = beat_cnt != 0;
+    |
+    |endmodule
+  """.stripMargin)
+}
+
 class RAM(implicit val p: Parameters) extends RawModule with SimParams {
   val io = IO(new AxiSlaveIO)
 
@@ -71,10 +180,10 @@ class RAM(implicit val p: Parameters) extends RawModule with SimParams {
 
   withClockAndReset(io.basic.ACLK, !io.basic.ARESETn) {
     val AWREADY = RegInit(1.B); io.channel.aw.ready := AWREADY
-    val WREADY  = RegInit(0.B); io.channel.w .ready := WREADY
-    val BVALID  = RegInit(0.B); io.channel.b .valid := BVALID
+    val WREADY  = RegInit(0.B)
+    val BVALID  = RegInit(0.B)
     val ARREADY = RegInit(1.B); io.channel.ar.ready := ARREADY
-    val RVALID  = RegInit(0.B); io.channel.r .valid := RVALID
+    val RVALID  = RegInit(0.B)
     val ARSIZE  = RegInit(0.U(3.W))
     val ARLEN   = RegInit(0.U(8.W))
     val AWSIZE  = RegInit(0.U(3.W))
@@ -94,29 +203,58 @@ class RAM(implicit val p: Parameters) extends RawModule with SimParams {
       when(AWSIZE === i.U) { wireWStep := (1 << i).U }
     }
 
-    val ram_read = Module(new RamRead)
+    val ram_read = Module(new RamRead(p(BURST_LEN)))
     ram_read.io.clock := io.basic.ACLK
+    ram_read.io.start := 0.B
+    ram_read.io.next  := 0.B
     ram_read.io.addr  := wireARADDR
+    ram_read.io.size  := io.channel.ar.bits.size
+    ram_read.io.len   := io.channel.ar.bits.len
     io.channel.r.bits.data := ram_read.io.data
 
-    val ram_write = Module(new RamWrite)
+    val ram_write = Module(new RamWrite(p(BURST_LEN)))
     ram_write.io.clock := io.basic.ACLK
     ram_write.io.wen   := 0.B
     ram_write.io.addr  := AWADDR
+    ram_write.io.size  := AWSIZE
+    ram_write.io.len   := AWLEN
     ram_write.io.data  := io.channel.w.bits.data
     ram_write.io.mask  := io.channel.w.bits.strb
 
+    val read_timing = Module(new RamTiming)
+    read_timing.io.clock := io.basic.ACLK
+    read_timing.io.start := io.channel.ar.fire
+    read_timing.io.write := 0.B
+    read_timing.io.id    := io.channel.ar.bits.id
+    read_timing.io.addr  := io.channel.ar.bits.addr - DRAM.BASE.U
+    read_timing.io.len   := io.channel.ar.bits.len
+    read_timing.io.beat  := io.channel.r.fire && ARLEN =/= 0.U
+    io.channel.r.valid := RVALID && !read_timing.io.first_wait && !read_timing.io.beat_wait
+
+    val write_timing = Module(new RamTiming)
+    write_timing.io.clock := io.basic.ACLK
+    write_timing.io.start := io.channel.aw.fire
+    write_timing.io.write := 1.B
+    write_timing.io.id    := io.channel.aw.bits.id
+    write_timing.io.addr  := io.channel.aw.bits.addr - DRAM.BASE.U
+    write_timing.io.len   := io.channel.aw.bits.len
+    write_timing.io.beat  := io.channel.w.fire && AWLEN =/= 0.U
+    io.channel.w.ready := WREADY && !write_timing.io.beat_wait
+    io.channel.b.valid := BVALID && !write_timing.io.first_wait
+
     when(io.channel.r.fire) {
       when(ARLEN === 0.U) {
         RVALID         := 0.B
         ARREADY        := 1.B
         io.channel.r.bits.last := 1.B
       }.otherwise {
+        ram_read.io.next := 1.B
         wireARADDR := ARADDR + wireRStep
         ARADDR     := wireARADDR
         ARLEN      := ARLEN - 1.U
       }
     }.elsewhen(io.channel.ar.fire) {
+      ram_read.io.start := 1.B
       RID        := io.channel.ar.bits.id
       wireARADDR := io.channel.ar.bits.addr(alen - 1, axSize) ## 0.U(axSize.W) - DRAM.BASE.U
       ARADDR     := wireARADDR
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <svdpi.h>
+#include <sim_main.hpp>
+
+// Timing of the simulated DRAM, consulted by AXI_RAM once per burst. The
+// slave itself answers one cycle after a request and moves one beat per
+// cycle; everything returned here is waited on top of that.
+//
+//   ideal  the slave as it is
+//   fixed  every burst sees `latency` cycles to the first beat and
+//          `beat` cycles per beat
+//   bank   addresses are interleaved over `banks` banks by `row` bytes; a
+//          burst waits for its bank and for the shared data bus, and pays
+//          `row_miss` more cycles when its row is not the open one
+//
+// Bursts with the same AXI ID on the same channel complete in order.
+
+#define DRAM_MAX_BANKS 64
+#define DRAM_MAX_ID    16
+
+extern uint64_t cycles;
+
+dram_config_t dram_config = { DRAM_IDEAL, 20, 1, 8, 2048, 20 };
+
+static uint64_t bus_free;
+static uint64_t bank_free[DRAM_MAX_BANKS], open_row[DRAM_MAX_BANKS];
+static uint64_t id_free[2][DRAM_MAX_ID];
+static uint64_t nr_burst[2], nr_row_miss, nr_wait;
+
+static inline uint64_t max(uint64_t a, uint64_t b) { return a > b ? a : b; }
+
+extern "C" void dram_init(void) {
+  dram_config_t &c = dram_config;
+  Assert(c.latency >= 1 && c.beat >= 1, "DRAM latency and beat must be at least 1 cycle");
+  Assert(c.banks >= 1 && c.banks <= DRAM_MAX_BANKS, "DRAM banks must be within 1 to %d", DRAM_MAX_BANKS);
+  Assert(c.row && (c.row & (c.row - 1)) == 0, "DRAM row must be a power of 2");
+  memset(open_row, 0xff, sizeof(open_row));
+  if (c.model == DRAM_FIXED)
+    printf(DEBUG "DRAM: %d cycles to the first beat, %d per beat.\n", c.latency, c.beat);
+  else if (c.model == DRAM_BANK)
+    printf(DEBUG "DRAM: %d banks of %d-byte rows, %d cycles to the first beat (+%d on a row miss), %d per beat.\n",
+           c.banks, c.row, c.latency, c.row_miss, c.beat);
+}
+
+// Returns the cycles to hold back the first R beat (reads) or B (writes)
+// and sets `beat` to the cycles to hold back every following beat.
+extern "C" int ram_timing(svBit write, uint8_t id, uint64_t addr, uint8_t len, int *beat) {
+  const dram_config_t &c = dram_config;
+  *beat = 0;
+  if (c.model == DRAM_IDEAL) return 0;
+  *beat = c.beat - 1;
+
+  uint64_t now = cycles / 2;
+  uint64_t &id_done = id_free[write][id % DRAM_MAX_ID];
+  uint64_t start = max(now, id_done);
+  uint64_t ready;
+  if (c.model == DRAM_BANK) {
+    uint64_t bank = (addr / c.row) % c.banks, row = addr / c.row / c.banks;
+    ready = max(start, bank_free[bank]) + c.latency;
+    if (open_row[bank] != row) {
+      ready += c.row_miss;
+      open_row[bank] = row;
+      nr_row_miss++;
+    }
+    ready = max(ready, bus_free);
+    bank_free[bank] = ready + ((uint64_t)len + 1) * c.beat;
+  } else ready = max(start + c.latency, bus_free);
+
+  bus_free = ready + ((uint64_t)len + 1) * c.beat;
+  id_done = bus_free;
+  nr_burst[write]++;
+
+  uint64_t done = write ? bus_free : ready;
+  uint64_t wait = done > now + 1 ? done - now - 1 : 0;
+  nr_wait += wait;
+  return wait;
+}
+
+extern "C" void dram_report(void) {
+  if (dram_config.model == DRAM_IDEAL) return;
+  uint64_t n = nr_burst[0] + nr_burst[1];
+  printf(DEBUG "DRAM: %ld read and %ld write bursts, %.1f cycles waited per burst", nr_burst[0], nr_burst[1], n ? (double)nr_wait / n : 0.0);
+  if (dram_config.model == DRAM_BANK) printf(", %.1f%% row misses", n ? 100.0 * nr_row_miss / n : 0.0);
+  printf(".\n");
+}
+
+#ifdef CHECKPOINT
+void dram_save(VerilatedSerialize &os) {
+  os << bus_free;
+  os.write(bank_free, sizeof(bank_free));
+  os.write(open_row, sizeof(open_row));
+  os.write(id_free, sizeof(id_free));
+}
+
+void dram_restore(VerilatedDeserialize &os) {
+  os >> bus_free;
+  os.read(bank_free, sizeof(bank_free));
+  os.read(open_row, sizeof(open_row));
+  os.read(id_free, sizeof(id_free));
+}
+#endif
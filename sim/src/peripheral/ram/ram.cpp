@@ -1,67 +1,140 @@
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include <stdint.h>
 #include <svdpi.h>
 #include <debug.hpp>
+#include <guest_mem.hpp>
+#ifdef CHECKPOINT
+#include <checkpoint.hpp>
+#endif
 
 // ramdisk
 #define BSIZE  1024  // block size
 #define FSSIZE 1000  // size of file system in blocks
 
+#define RAM_BASE  0x80000000UL
 #define RAM_SIZE  (1024 * 1024 * 1024)
 #define PMEM_SIZE (RAM_SIZE + BSIZE * FSSIZE)
 
 #define PAGE_SIZE 4096
 #define PAGE_MASK (PAGE_SIZE - 1)
-#define PG_ALIGN __attribute((aligned(PAGE_SIZE)))
 
 static inline bool in_pmem(uint64_t addr) {
   return (addr < PMEM_SIZE);
 }
 
-static uint8_t pmem[PMEM_SIZE] PG_ALIGN = {};
+static uint8_t *pmem = NULL;
+static int hugepage = HUGEPAGE_NONE;
+static uint64_t loaded[2][2]; // offset and size of the image and the ramdisk
+static int nr_loaded = 0;
 
 extern "C" uint64_t ram_read(uint64_t addr) {
-  return in_pmem(addr) ? *(uint64_t *)(pmem + addr) : 0xBB;
+  // the RTL only asks for aligned beats inside DRAM
+  if (__builtin_expect(in_pmem(addr), 1)) return *(uint64_t *)(pmem + addr);
+  return 0xBB;
+}
+
+// expand a byte strobe to a bit mask, bit i of `mask` becomes byte i
+static inline uint64_t strb_to_mask(uint8_t mask) {
+  uint64_t m = mask;
+  m = (m | m << 28) & 0x0000000F0000000FULL;
+  m = (m | m << 14) & 0x0003000300030003ULL;
+  m = (m | m <<  7) & 0x0101010101010101ULL;
+  return m * 0xFF;
+}
+
+static inline void ram_store(uint64_t addr, uint64_t data, uint8_t mask) {
+  uint64_t *p = (uint64_t *)(pmem + addr);
+  if (mask == 0xFF) *p = data;
+  else if (mask) {
+    uint64_t m = strb_to_mask(mask);
+    *p = (*p & ~m) | (data & m);
+  }
 }
 
 extern "C" void ram_write(uint64_t addr, uint64_t data, uint8_t mask) {
-  uint8_t *p = &pmem[addr];
-  if (in_pmem(addr))
-    for (int i = 0; i < 8; i++) {
-      if (mask & 1) *p = data;
-      p++;
-      data >>= 8;
-      mask >>= 1;
-    }
+  if (__builtin_expect(in_pmem(addr), 1)) ram_store(addr, data, mask);
 }
 
-extern "C" void *ram_init(char *img) {
-  FILE *fp = fopen(img, "rb");
-  Assert(fp, "Can not open '%s'", img);
+// Whole bursts, `len` + 1 beats of 1 << `size` bytes each. Every beat is
+// still a 64-bit word on the bus, packed little-endian in `data`.
+extern "C" void ram_read_burst(uint64_t addr, uint8_t size, uint8_t len, svBitVecVal *data) {
+  uint64_t n = (uint64_t)len + 1;
+  if (size == 3 && in_pmem(addr) && in_pmem(addr + n * 8 - 1)) {
+    memcpy(data, pmem + addr, n * 8);
+    return;
+  }
+  for (uint64_t i = 0; i < n; i++) {
+    uint64_t word = ram_read(addr + (i << size));
+    memcpy(data + i * 2, &word, 8);
+  }
+}
 
-  fseek(fp, 0, SEEK_END);
-  uint64_t size = ftell(fp);
+extern "C" void ram_write_burst(uint64_t addr, uint8_t size, uint8_t len, const svBitVecVal *data, const svBitVecVal *mask) {
+  const uint8_t *strb = (const uint8_t *)mask;
+  for (uint64_t i = 0; i <= len; i++) {
+    uint64_t word;
+    memcpy(&word, data + i * 2, 8);
+    ram_write(addr + (i << size), word, strb[i]);
+  }
+}
 
-  fseek(fp, 0, SEEK_SET);
-  assert(fread(pmem, size, 1, fp) == 1);
+// Host address of `size` bytes of guest memory at physical `addr`, for
+// device models that move data by DMA. NULL if it is not all in DRAM.
+extern "C" uint8_t *ram_dma(uint64_t addr, uint64_t size) {
+  if (addr < RAM_BASE || addr - RAM_BASE > PMEM_SIZE || size > PMEM_SIZE - (addr - RAM_BASE)) return NULL;
+  return pmem + addr - RAM_BASE;
+}
 
-  fclose(fp);
+extern "C" void ram_set_hugepage(int mode) {
+  hugepage = mode;
+}
+
+// Guest memory is reserved lazily, and the image and ramdisk are mapped
+// copy-on-write, so RSS only grows with what the guest touches. Hugepages
+// cannot back a 4 KiB file mapping, so the files are copied in that case.
+// The fork server starts without an image and loads one in each child.
+extern "C" void ram_load(char *img) {
+  nr_loaded = 0;
+  long size = guest_mem_load(pmem, RAM_SIZE, img, hugepage != HUGEPAGE_NONE);
+  Assert(size >= 0, "Can not load '%s'", img);
+  loaded[nr_loaded][0] = 0;
+  loaded[nr_loaded++][1] = size;
 
   // ramdisk
   std::string ramdisk = img;
-  ramdisk.replace(ramdisk.find(".bin"), 4, "-ramdisk.img");
-  if ((fp = fopen(ramdisk.c_str(), "rb"))) {
+  size_t ext = ramdisk.find(".bin");
+  if (ext == std::string::npos) return;
+  ramdisk.replace(ext, 4, "-ramdisk.img");
+  size = guest_mem_load(pmem + RAM_SIZE, BSIZE * FSSIZE, ramdisk.c_str(), hugepage != HUGEPAGE_NONE);
+  if (size >= 0) {
     printf(DEBUG "found ramdisk %s\n", ramdisk.c_str());
+    loaded[nr_loaded][0] = RAM_SIZE;
+    loaded[nr_loaded++][1] = size;
+  }
+}
 
-    fseek(fp, 0, SEEK_END);
-    size = ftell(fp);
+extern "C" void *ram_init(char *img) {
+  pmem = guest_mem_alloc(PMEM_SIZE + PAGE_SIZE, &hugepage);
+  Assert(pmem, "Can not allocate guest memory");
+  if (img) ram_load(img);
+  return pmem;
+}
 
-    fseek(fp, 0, SEEK_SET);
-    assert(fread(pmem + RAM_SIZE, size, 1, fp));
+extern "C" bool ram_loaded(int i, uint64_t *off, uint64_t *size) {
+  if (i >= nr_loaded) return false;
+  *off  = loaded[i][0];
+  *size = loaded[i][1];
+  return true;
+}
 
-    fclose(fp);
-  }
+#ifdef CHECKPOINT
+void ram_save(VerilatedSerialize &os) {
+  checkpoint_save_mem(os, pmem, PMEM_SIZE);
+}
 
-  return pmem;
+void ram_restore(VerilatedDeserialize &os) {
+  checkpoint_restore_mem(os, pmem, PMEM_SIZE);
 }
+#endif
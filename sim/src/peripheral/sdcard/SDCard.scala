@@ -39,28 +39,54 @@ class SDCardWrite(implicit val p: Parameters) extends BlackBox with HasBlackBoxI
     val wen   = Input (Bool())
     val waddr = Input (UInt(8.W))
     val wdata = Input (UInt(8.W))
+    val done  = Input (Bool())
+    val irq   = Output(Bool())
+    val want  = Output(Bool())
   })
 
+  // A DMA command only raises `want`, and the transfer is done in
+  // sdcard_flushed on the cycle the DCache acknowledges.
   setInline("SDCardWrite.v", s"""
-    |import "DPI-C" function void sdcard_write(input longint addr, input int data);
+    |import "DPI-C" function int sdcard_write(input longint addr, input int data);
+    |import "DPI-C" function int sdcard_flushed();
+    |import "DPI-C" function void sdcard_dma_init(input bit flush);
     |
     |module SDCardWrite (
     |  input clock,
     |  input wen,
     |  input [63:0] waddr,
-    |  input [31:0] wdata
+    |  input [31:0] wdata,
+    |  input done,
+    |  output irq,
+    |  output want
     |);
     |
+    |  reg [1:0] state;
+    |  assign irq  = state[0];
+    |  assign want = state[1];
+    |
+    |  initial begin
+    |    state = 0;
+    |    sdcard_dma_init(1'b${if (useDmaFlush) 1 else 0});
+    |  end
+    |
     |  always@(posedge clock) begin
-    |    if (wen) sdcard_write(waddr, wdata);
+    |    if (wen) state <= sdcard_write(waddr, wdata);
+    |    if (done) state <= sdcard_flushed();
     |  end
     |
     |endmodule
   """.stripMargin)
 }
 
+class SDCardIO(implicit p: Parameters) extends AxiSlaveIO {
+  val interrupt = Output(Bool())    // DMA completion (active-high)
+}
+
 class SDCard(implicit val p: Parameters) extends RawModule with SimParams {
-  val io = IO(new AxiSlaveIO)
+  val io = IO(new SDCardIO {
+    val flush = if (useDmaFlush) Irrevocable(UInt(0.W)) else null // write back and invalidate the DCache
+  })
   io.channel.b.bits.resp := 0.U
   io.channel.b.bits.user := DontCare
 
@@ -93,6 +119,14 @@ class SDCard(implicit val p: Parameters) extends RawModule with SimParams {
     sdcard_write.io.wen   := 0.B
     sdcard_write.io.waddr := AWADDR
     sdcard_write.io.wdata := VecInit((0 until 8).map { i => io.channel.w.bits.data >> (8 * i) })(AWADDR(2, 0))
+    sdcard_write.io.done  := 0.B
+    io.interrupt          := sdcard_write.io.irq
+
+    if (useDmaFlush) {
+      sdcard_write.io.done := io.flush.fire
+      io.flush.valid := sdcard_write.io.want
+      io.flush.bits  := DontCare
+    }
 
     when(io.channel.r.fire) {
       RVALID  := 0.B
@@ -1,9 +1,12 @@
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include <stdint.h>
 #include <svdpi.h>
 #include <debug.hpp>
 #include <mmc.hpp>
+#include <disk.hpp>
+#include <sim_main.hpp>
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
 
@@ -17,8 +20,18 @@
 #define C_SIZE (NR_BLOCK / MULT - 1)
 
 // This is a simple hardware implementation of linux/drivers/mmc/host/bcm2835.c
-// No DMA and IRQ is supported, so the driver must be modified to start PIO
-// right after sending the actual read/write commands.
+// By default there is no DMA and IRQ, so the driver must be modified to start
+// PIO right after sending the actual read/write commands.
+//
+// With SDDMACTL_EN set, a multiple block read/write command instead moves all
+// SDHBLC blocks (or the SET_BLOCK_COUNT count) between the card and guest
+// memory at SDDMAADDR at once, then sets SDDMASTS_DONE, which raises the
+// interrupt if SDDMACTL_IRQ is set. Writing SDDMASTS_DONE clears it. A buffer
+// outside guest memory is not copied and also sets SDDMASTS_ERR. The copy is
+// queued until the DCache has been written back and invalidated, through the
+// flush port shared with the DMAC and virtio, so no cache maintenance is
+// needed. Without that port (outside the ysyx build), SDDMACTL_EN reads back
+// as 0 and the card only does PIO.
 
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
@@ -26,22 +39,58 @@ enum {
   SDHSTS, __PAD0, __PAD1, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
   SDDATA, __PAD10, __PAD11, __PAD12,
-  SDHBLC
+  SDHBLC,
+  SDDMAADDRLO = 0x20, SDDMAADDRHI, SDDMACTL, SDDMASTS
 };
 
-static FILE *fp = NULL;
+enum { SDDMACTL_EN = 1, SDDMACTL_IRQ = 2 };
+enum { SDDMASTS_DONE = 1, SDDMASTS_ERR = 2 };
+
+static disk_t disk = {};
+static const char *overlay_file = NULL;
+static uint8_t *sector = NULL; // sector of the current SDDATA access
+
 static uint32_t base[0x80] = {};
 static uint32_t blkcnt = 0;
 static long blk_addr = 0;
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
+static bool dma_flush = false;   // the SoC has the DCache flush port
+static bool dma_pending = false; // a transfer waits for the flush
+
+// The SDCardWrite state: bit 0 the interrupt line, bit 1 the flush request.
+static int sdcard_state() {
+  return ((base[SDDMACTL] & SDDMACTL_IRQ) && (base[SDDMASTS] & SDDMASTS_DONE)) | dma_pending << 1;
+}
+
+static void dma_rw(bool is_write) {
+  uint64_t nr = base[SDHBLC] ? base[SDHBLC] : blkcnt;
+  uint64_t mem = ((uint64_t)base[SDDMAADDRHI] << 32) | base[SDDMAADDRLO];
+  uint8_t *p = ram_dma(mem, nr * SECTOR_SIZE);
+  if (!p) {
+    printf("sdcard DMA to 0x%lx is out of memory\n", mem);
+    base[SDDMASTS] |= SDDMASTS_DONE | SDDMASTS_ERR;
+    return;
+  }
+  for (uint64_t i = 0; i < nr; i++) {
+    uint8_t *sec = disk_sector(&disk, blk_addr + i, is_write);
+    uint8_t *buf = p + i * SECTOR_SIZE;
+    if (is_write) { if (sec) memcpy(sec, buf, SECTOR_SIZE); }
+    else if (sec) memcpy(buf, sec, SECTOR_SIZE);
+    else memset(buf, 0, SECTOR_SIZE);
+  }
+#ifdef DIFFTEST
+  if (!is_write) difftest_dma(mem, p, nr * SECTOR_SIZE);
+#endif
+  base[SDDMASTS] |= SDDMASTS_DONE;
+}
 
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
+  if ((base[SDDMACTL] & SDDMACTL_EN) && disk.data) dma_pending = true;
 }
 
 static void sdcard_handle_cmd(int cmd) {
@@ -81,6 +130,12 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
   int idx = offset >> 2;
   switch (idx) {
     case SDCMD: sdcard_handle_cmd(base[SDCMD] & 0x3f); break;
+    case SDDMAADDRLO:
+    case SDDMAADDRHI:
+    case SDDMACTL:
+    case SDDMASTS:
+    case SDHBCT:
+    case SDHBLC:
     case SDARG:
     case SDRSP0:
     case SDRSP1:
@@ -98,11 +153,13 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
-       }else{
+       } else if (disk.data) {
+         uint32_t off = addr % SECTOR_SIZE;
+         if (off == 0) sector = disk_sector(&disk, blk_addr + addr / SECTOR_SIZE, write_cmd);
+         if (!sector) { if (!write_cmd) base[SDDATA] = 0; }
+         else if (!write_cmd) memcpy(&base[SDDATA], sector + off, 4);
+         else memcpy(sector + off, &base[SDDATA], 4);
+       } else {
          assert(0);
        }
        addr += 4;
@@ -117,14 +174,55 @@ extern "C" void sdcard_read(uint64_t addr, uint32_t *rdata) {
   *rdata = base[addr >> 2];
 }
 
-extern "C" void sdcard_write(uint64_t addr, uint32_t wdata) {
-  base[addr >> 2] = wdata;
-  sdcard_io_handler(addr, 4, 1);
+// Returns the new state, which only a write or a flush can change.
+extern "C" int sdcard_write(uint64_t addr, uint32_t wdata) {
+  if ((addr >> 2) == SDDMASTS) base[SDDMASTS] &= ~wdata; // write 1 to clear
+  else {
+    base[addr >> 2] = wdata;
+    if ((addr >> 2) == SDDMACTL && !dma_flush) base[SDDMACTL] &= ~SDDMACTL_EN;
+    sdcard_io_handler(addr, 4, 1);
+  }
+  return sdcard_state();
+}
+
+extern "C" void sdcard_dma_init(svBit flush) {
+  dma_flush = flush;
+}
+
+// The DCache holds nothing now, so the queued transfer can be done.
+extern "C" int sdcard_flushed() {
+  if (dma_pending) {
+    dma_pending = false;
+    dma_rw(write_cmd);
+  }
+  return sdcard_state();
+}
+
+extern "C" void sdcard_set_overlay(const char *file) {
+  overlay_file = file;
 }
 
 extern "C" void sdcard_init(char *img) {
   std::string sdcard = img;
-  sdcard.replace(sdcard.find(".bin"), 4, "-sdcard.img");
-  if ((fp = fopen(sdcard.c_str(), "rb")))
-    printf(DEBUG "found sdcard %s\n", sdcard.c_str());
+  size_t ext = sdcard.find(".bin");
+  if (ext == std::string::npos) return;
+  sdcard.replace(ext, 4, "-sdcard.img");
+  if (disk_open(&disk, sdcard.c_str(), overlay_file)) printf(DEBUG "found sdcard %s\n", sdcard.c_str());
+}
+
+#ifdef CHECKPOINT
+void sdcard_save(VerilatedSerialize &os) {
+  os.write(base, sizeof(base));
+  os << blkcnt << addr << write_cmd << read_ext_csd << dma_pending;
+  os.write(&blk_addr, sizeof(blk_addr));
+  disk_save(os, &disk);
+}
+
+void sdcard_restore(VerilatedDeserialize &os) {
+  os.read(base, sizeof(base));
+  os >> blkcnt >> addr >> write_cmd >> read_ext_csd >> dma_pending;
+  os.read(&blk_addr, sizeof(blk_addr));
+  disk_restore(os, &disk);
+  sector = addr % SECTOR_SIZE ? disk_sector(&disk, blk_addr + addr / SECTOR_SIZE, write_cmd) : NULL;
 }
+#endif
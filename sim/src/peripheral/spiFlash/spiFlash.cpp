@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <svdpi.h>
+#include <guest_mem.hpp>
 
 #define Assert(cond, ...) \
   do { \
@@ -19,13 +20,12 @@
 
 #define PAGE_SIZE 4096
 #define PAGE_MASK (PAGE_SIZE - 1)
-#define PG_ALIGN __attribute((aligned(PAGE_SIZE)))
 
 static inline bool in_pmem(uint64_t addr) {
   return (addr < PMEM_SIZE);
 }
 
-static uint8_t pmem[PMEM_SIZE] PG_ALIGN = {};
+static uint8_t *pmem = NULL;
 
 extern "C" uint64_t flash_read(uint64_t addr) {
   Assert(in_pmem(addr), "Flash address 0x%lx out of bound", addr);
@@ -33,14 +33,8 @@ extern "C" uint64_t flash_read(uint64_t addr) {
 }
 
 extern "C" void flash_init(char *img) {
-  FILE *fp = fopen(img, "rb");
-  Assert(fp, "Can not open '%s'", img);
-
-  fseek(fp, 0, SEEK_END);
-  uint64_t size = ftell(fp);
-
-  fseek(fp, 0, SEEK_SET);
-  assert(fread(pmem, size, 1, fp) == 1);
-
-  fclose(fp);
+  int hugepage = HUGEPAGE_NONE;
+  pmem = guest_mem_alloc(PMEM_SIZE + PAGE_SIZE, &hugepage);
+  Assert(pmem, "Can not allocate flash memory");
+  Assert(guest_mem_load(pmem, PMEM_SIZE, img, false) >= 0, "Can not load '%s'", img);
 }
@@ -2,27 +2,49 @@
 
 `define spi_cs_num 2
 
+// Read commands: 03h read, 0Bh fast read, 3Bh dual output, 6Bh quad output
+// and EBh quad I/O. An EBh mode byte of 10xx_xxxxb enters continuous-read
+// mode: the following transfers start with the address and skip the command,
+// until a mode byte without it is sent. Data is always read from the word
+// the address falls in and wraps around every 8 bytes.
 module spiFlash (
   input                    spi_clk,
   input  [`spi_cs_num-1:0] spi_cs,
   input                    spi_mosi,
   output wire              spi_miso,
+  input              [3:0] spi_qmosi,
+  output wire        [3:0] spi_qmiso,
   input                    spi_irq_out
 );
 
-  typedef enum [2:0] { cmd_t, addr_t, data_t, err_t } state_t;
+  typedef enum [2:0] { cmd_t, addr_t, mode_t, dummy_t, data_t, err_t } state_t;
 
   wire reset; assign reset = spi_cs[0];
 
   reg [2:0]  state;
   reg [7:0]  counter;
   reg [7:0]  cmd;
-  reg [21:0] addr;
-  reg [63:0] data;   assign spi_miso = data[63];
+  reg [23:0] addr;
+  reg [3:0]  mode;
+  reg        cont;
+  reg [63:0] data;
 
-  wire        ren;   assign ren = (state == addr_t) && (counter == 8'd22);
+  wire       cmd_ok;    assign cmd_ok    = cmd == 8'h03 || cmd == 8'h0b || cmd == 8'h3b || cmd == 8'h6b || cmd == 8'heb;
+  wire       addr_quad; assign addr_quad = cmd == 8'heb;
+  wire [7:0] addr_last; assign addr_last = addr_quad ? 8'd5 : 8'd23;
+  wire [7:0] dummy;     assign dummy     = (cmd == 8'h03) ? 8'd0 : (cmd == 8'heb) ? 8'd4 : 8'd8;
+  wire [2:0] width;     assign width     = (cmd == 8'h3b) ? 3'd2 : (cmd == 8'h6b || cmd == 8'heb) ? 3'd4 : 3'd1;
+
+  assign spi_miso  = data[63];
+  assign spi_qmiso = (width == 3'd4) ? data[63:60] :
+                     (width == 3'd2) ? { 2'd0, data[63:62] } : { 2'd0, data[63], 1'b0 };
+
+  // 03h has no dummy cycles, so the word is fetched with the last two
+  // address bits still on the way, and the others once the address is in.
+  wire        ren;   assign ren = (state == addr_t) ? (cmd == 8'h03 && counter == 8'd22) :
+                                  (state == (addr_quad ? mode_t : dummy_t)) && counter == 8'd0;
   wire [63:0] rdata;
-  wire [63:0] raddr; assign raddr = { 40'd0, addr, 2'd0 };
+  wire [63:0] raddr; assign raddr = (state == addr_t) ? { 40'd0, addr[21:0], 2'd0 } : { 40'd0, addr[23:2], 2'd0 };
   FlashRead flashRead (
     .clock(spi_clk),
     .ren(ren),
@@ -30,18 +52,24 @@ module spiFlash (
     .data(rdata)
   );
 
+  wire to_data; assign to_data = (state == addr_t  && counter == addr_last && cmd == 8'h03) ||
+                                 (state == dummy_t && counter == dummy - 8'd1);
+
   always@(posedge spi_clk or posedge reset) begin
-    if (reset) state <= cmd_t;
+    if (reset) state <= cont ? addr_t : cmd_t;
     else begin
       case (state)
-        cmd_t:  state <= (counter == 8'd7 ) ? addr_t : state;
-        addr_t: state <= (cmd     != 8'h3 ) ? err_t  :
-                         (counter == 8'd23) ? data_t : state;
-        data_t: state <= state;
-        
+        cmd_t:   state <= (counter == 8'd7) ? addr_t : state;
+        addr_t:  state <= !cmd_ok ? err_t :
+                          (counter != addr_last) ? state :
+                          addr_quad ? mode_t : (dummy == 8'd0) ? data_t : dummy_t;
+        mode_t:  state <= (counter == 8'd1) ? dummy_t : state;
+        dummy_t: state <= to_data ? data_t : state;
+        data_t:  state <= state;
+
         default: begin
           state <= state;
-          $fwrite(32'h80000002, "Assertion failed: only support `03h` read command\n");
+          $fwrite(32'h80000002, "Assertion failed: only support `03h`, `0Bh`, `3Bh`, `6Bh` and `EBh` read commands\n");
           $fatal;
         end
       endcase
@@ -52,32 +80,48 @@ module spiFlash (
     if (reset) counter <= 8'd0;
     else begin
       case (state)
-        cmd_t:   counter <= (counter < 8'd7 ) ? counter + 8'd1 : 8'd0;
-        addr_t:  counter <= (counter < 8'd23) ? counter + 8'd1 : 8'd0;
+        cmd_t:   counter <= (counter < 8'd7) ? counter + 8'd1 : 8'd0;
+        addr_t:  counter <= (counter < addr_last) ? counter + 8'd1 : 8'd0;
+        mode_t:  counter <= (counter < 8'd1) ? counter + 8'd1 : 8'd0;
+        dummy_t: counter <= to_data ? 8'd0 : counter + 8'd1;
         default: counter <= counter + 8'd1;
       endcase
     end
   end
 
+  // The command survives a deselect in continuous-read mode.
   always@(posedge spi_clk or posedge reset) begin
-    if (reset)               cmd <= 8'd0;
+    if (reset)               cmd <= cont ? cmd : 8'd0;
     else if (state == cmd_t) cmd <= { cmd[6:0], spi_mosi };
   end
 
   always@(posedge spi_clk or posedge reset) begin
-    if (reset) addr <= 22'd0;
-    else if (state == addr_t && counter < 8'd22)
-      addr <= { addr[20:0], spi_mosi };
+    if (reset) addr <= 24'd0;
+    else if (state == addr_t)
+      addr <= addr_quad ? { addr[19:0], spi_qmosi } : { addr[22:0], spi_mosi };
+  end
+
+  initial cont = 1'b0;
+  always@(posedge spi_clk) begin
+    if (state == mode_t) begin
+      mode <= spi_qmosi;
+      if (counter == 8'd1) cont <= mode[1:0] == 2'b10;
+    end
   end
 
   always@(posedge spi_clk or posedge reset) begin
     if (reset) data <= 64'd0;
-    else if (state == addr_t && counter == 8'd23)
+    else if (to_data)
       data <= {
         rdata[ 7: 0], rdata[15: 8], rdata[23:16], rdata[31:24],
         rdata[39:32], rdata[47:40], rdata[55:48], rdata[63:56]
       };
-    else if (state == data_t) data <= { data[62:0], data[63] };
+    else if (state == data_t)
+      case (width)
+        3'd4:    data <= { data[59:0], data[63:60] };
+        3'd2:    data <= { data[61:0], data[63:62] };
+        default: data <= { data[62:0], data[63] };
+      endcase
   end
 
 endmodule
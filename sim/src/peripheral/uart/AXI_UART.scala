@@ -59,22 +59,28 @@ class UartWrite(implicit val p: Parameters) extends BlackBox with HasBlackBoxInl
   """.stripMargin)
 }
 
+// The interrupt line is only written from C++, through uart_set_int, when
+// the receive FIFO or IER changes. uart_int_init tells uart.cpp the scope.
 class UartInt(implicit val p: Parameters) extends BlackBox with HasBlackBoxInline with SimParams {
   val io = IO(new Bundle {
-    val clock = Input (Clock())
     val inter = Output(Bool())
   })
 
   setInline("UartInt.v", s"""
-    |import "DPI-C" function void uart_int(output bit inter);
+    |import "DPI-C" context function void uart_int_init();
     |
     |module UartInt (
-    |  input  clock,
-    |  output inter
+    |  output reg inter
     |);
     |
-    |  always@(posedge clock) begin
-    |    uart_int(inter);
+    |  export "DPI-C" function uart_set_int;
+    |  function void uart_set_int(input bit level);
+    |    inter = level;
+    |  endfunction
+    |
+    |  initial begin
+    |    inter = 0;
+    |    uart_int_init();
     |  end
     |
     |endmodule
@@ -124,8 +130,7 @@ class UartSim(implicit val p: Parameters) extends UartWrapper {
     uart_write.io.wdata := VecInit((0 until 8).map { i => io.channel.w.bits.data >> (8 * i) })(AWADDR)
 
     val uart_int = Module(new UartInt)
-    uart_int.io.clock := io.basic.ACLK
-    io.interrupt      := uart_int.io.inter
+    io.interrupt := uart_int.io.inter
 
     when(io.channel.r.fire) {
       RVALID  := 0.B
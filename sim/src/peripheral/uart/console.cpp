@@ -0,0 +1,168 @@
+#include <termio.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string>
+#include <atomic>
+#include <debug.hpp>
+#include <console.hpp>
+#include <spsc_queue.hpp>
+
+#define FIFO_SIZE 1024
+static spsc_queue<char, FIFO_SIZE> fifo;
+static pthread_t thread_in;
+static bool started = false;
+static bool input = true;
+static std::atomic<bool> arrived{false};
+
+// Output goes through a ring drained by thread_out, so the simulation never
+// waits on the terminal, unless the ring is full.
+#define TX_SIZE (64 * 1024)
+static spsc_queue<char, TX_SIZE> tx;
+static int tx_fd = STDOUT_FILENO;
+static uint64_t tx_sent = 0;
+static std::atomic<uint64_t> tx_written{0};
+static pthread_t thread_out;
+static bool muted = false;
+
+// Input handed in by the simulation thread itself (command_init, restored
+// checkpoints). Only the consumer touches it, so it does not go through
+// the ring, which has a single producer.
+static std::string pending;
+static size_t pending_pos = 0;
+
+static void *fifo_in(void *) {
+  int key;
+  while ((key = getchar()) != EOF) {
+    while (!fifo.push(key)) usleep(1000);
+    arrived.store(true, std::memory_order_release);
+  }
+  return NULL;
+}
+
+static void *fifo_out(void *) {
+  char buf[4096];
+  while (true) {
+    size_t n = 0;
+    while (n < sizeof(buf) && tx.pop(buf[n])) n++;
+    if (!n) {
+      usleep(1000);
+      continue;
+    }
+    for (size_t off = 0; off < n; ) {
+      ssize_t w = write(tx_fd, buf + off, n - off);
+      if (w < 0 && errno != EINTR) break;
+      if (w > 0) off += w;
+    }
+    tx_written.fetch_add(n, std::memory_order_release);
+  }
+  return NULL;
+}
+
+// Non-canonical mode is set once here. The caller has already turned off
+// echo and restores the terminal on exit.
+void console_init(void) {
+  if (started) return;
+  started = true;
+  struct termios t;
+  if (tcgetattr(0, &t) == 0) {
+    t.c_lflag &= ~ICANON;
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    tcsetattr(0, TCSANOW, &t);
+  }
+  if (input) {
+    pthread_create(&thread_in, NULL, fifo_in, NULL);
+    pthread_detach(thread_in);
+  }
+  pthread_create(&thread_out, NULL, fifo_out, NULL);
+  pthread_detach(thread_out);
+}
+
+// The fork server reads its requests from stdin, so keys are not.
+void console_no_input(void) {
+  input = false;
+}
+
+void console_set_output(const char *file) {
+  tx_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  Assert(tx_fd >= 0, "Can not open '%s'", file);
+}
+
+void console_putc(char ch) {
+  if (muted) return;
+  while (!tx.push(ch)) sched_yield();
+  tx_sent++;
+}
+
+// Wait until everything sent so far has been written out.
+void console_flush(void) {
+  if (!started || muted) return;
+  while (tx_written.load(std::memory_order_acquire) != tx_sent) usleep(100);
+}
+
+// Only the calling thread survives fork(), so a child of the fork server
+// starts its own output thread. The parent had flushed the ring before.
+void console_restart(void) {
+  if (!started) return;
+  tx.clear();
+  tx_sent = 0;
+  tx_written.store(0, std::memory_order_relaxed);
+  pthread_create(&thread_out, NULL, fifo_out, NULL);
+  pthread_detach(thread_out);
+}
+
+// For a forked copy of the simulator, which has neither thread. What it
+// would print has already been printed by the parent.
+void console_mute(void) {
+  muted = true;
+}
+
+bool console_empty(void) {
+  return pending_pos == pending.size() && fifo.empty();
+}
+
+bool console_getc(char *ch) {
+  if (pending_pos < pending.size()) {
+    *ch = pending[pending_pos++];
+    if (pending_pos == pending.size()) {
+      pending.clear();
+      pending_pos = 0;
+    }
+    return true;
+  }
+  return fifo.pop(*ch);
+}
+
+void console_inject(const char *str) {
+  pending.append(str);
+  arrived.store(true, std::memory_order_relaxed);
+}
+
+// Whether input came in since the last call. Cheap enough to ask every cycle.
+bool console_arrived(void) {
+  return arrived.load(std::memory_order_relaxed) && arrived.exchange(false, std::memory_order_acquire);
+}
+
+#ifdef CHECKPOINT
+// Whatever is in the ring is moved to the pending input first, so the
+// keyboard thread can keep going while it is saved.
+void console_save(VerilatedSerialize &os) {
+  char ch;
+  while (fifo.pop(ch)) pending.push_back(ch);
+  pending.erase(0, pending_pos);
+  pending_pos = 0;
+  os << pending;
+}
+
+void console_restore(VerilatedDeserialize &os) {
+  fifo.clear();
+  os >> pending;
+  pending_pos = 0;
+}
+#endif
@@ -1,17 +1,21 @@
-#include <termio.h>
 #include <stdio.h>
-#include <pthread.h>
 #include <svdpi.h>
 #include <string.h>
+#include <debug.hpp>
+#include <console.hpp>
+#ifdef CHECKPOINT
+#include <checkpoint.hpp>
+#endif
 
-#define FIFO_SIZE 1024
-static char fifo[FIFO_SIZE] = {0};
-static short head = 0, tail = 0;
-bool uart_isRunning = false;
 static bool divisor_latch = false;
 static bool receive_interrupt = false;
 static char scratch = 0;
 
+// Level of the UartInt line as last written through uart_set_int.
+static svScope int_scope = NULL;
+static bool int_level = false, int_dirty = false;
+extern "C" void uart_set_int(svBit level);
+
 /* http://byterunner.com/16550.html */
 enum {
   Receive_Holding  = 0b000,
@@ -30,40 +34,17 @@ enum {
   Scratchpad_Write = 0b111
 }; // WRITE MODE
 
-static pthread_t thread_in;
-static pthread_mutex_t mutex_fifo_opt = PTHREAD_MUTEX_INITIALIZER;
-
-static inline int scanKeyboard() {
-  int in;
-  struct termios new_settings;
-  struct termios stored_settings;
-  tcgetattr(0, &stored_settings);
-  new_settings = stored_settings;
-  new_settings.c_lflag &= (~ICANON);
-  new_settings.c_cc[VTIME] = 0;
-  tcgetattr(0, &stored_settings);
-  new_settings.c_cc[VMIN] = 1;
-  tcsetattr(0, TCSANOW, &new_settings);
-  in = getchar();
-  tcsetattr(0, TCSANOW, &stored_settings);
-  return in;
-}
-
 extern "C" void uart_read(char addr, char *ch) {
   if (!ch) return;
   switch (addr) {
     case Receive_Holding:
-      pthread_mutex_lock(&mutex_fifo_opt);
-      if (head != tail) {
-        *ch = fifo[head];
-        head = (head + 1) % FIFO_SIZE;
-      } else *ch = -1;
-      pthread_mutex_unlock(&mutex_fifo_opt);
+      if (!console_getc(ch)) *ch = -1;
+      else int_dirty = true;
       break;
     case Interrupt_Status:
-      *ch = receive_interrupt ? ((head == tail) ? 1 : 1 << 2) : 1; break;
+      *ch = receive_interrupt ? (console_empty() ? 1 : 1 << 2) : 1; break;
     case Line_Status:
-      *ch = 0b0110000 | (head != tail); break;
+      *ch = 0b0110000 | !console_empty(); break;
     case Modem_Status:
       *ch = 0; break;
     case Scratchpad_Read:
@@ -76,11 +57,14 @@ extern "C" void uart_read(char addr, char *ch) {
 extern "C" void uart_write(char addr, char data) {
   switch (addr) {
     case Transmit_Holding:
-      if (!divisor_latch)
-        putchar(data);
+      if (!divisor_latch) console_putc(data);
       break;
     case Interrupt_Enable:
-      if (!divisor_latch) receive_interrupt = (data & 1U); break;
+      if (!divisor_latch) {
+        receive_interrupt = (data & 1U);
+        int_dirty = true;
+      }
+      break;
     case Line_Control:
       divisor_latch = ((data & (1 << 7)) != 0); break;
     case Scratchpad_Write:
@@ -88,37 +72,48 @@ extern "C" void uart_write(char addr, char data) {
   }
 }
 
-static void fifo_in() {
-  uart_isRunning = true;
-  while (uart_isRunning) {
-    char key = scanKeyboard();
-    pthread_mutex_lock(&mutex_fifo_opt);
-    short n = (tail + 1) % FIFO_SIZE;
-    if (n != head) {
-      fifo[tail] = key;
-      tail = n;
-    }
-    pthread_mutex_unlock(&mutex_fifo_opt);
-  }
-}
-
 extern "C" void uart_init() {
-  pthread_create(&thread_in, NULL, (void *(*)(void *))fifo_in, NULL);
+  console_init();
 }
 
 extern "C" void uart_reset() {
-  pthread_mutex_lock(&mutex_fifo_opt);
-  head = tail = 0;
   scratch = 0;
   divisor_latch = false;
-  pthread_mutex_unlock(&mutex_fifo_opt);
 }
 
-extern "C" void uart_int(svBit *interrupt) {
-  if (interrupt) *interrupt = receive_interrupt && (head != tail);
+extern "C" void uart_int_init() {
+  int_scope = svGetScope();
+}
+
+// Called by the main loop between evaluations, never from inside a DPI
+// call, so writing the line does not race with the model.
+extern "C" void uart_poll() {
+  if (!console_arrived() && !int_dirty) return;
+  int_dirty = false;
+  bool level = receive_interrupt && !console_empty();
+  if (level == int_level || !int_scope) return;
+  int_level = level;
+  svScope prev = svSetScope(int_scope);
+  uart_set_int(level);
+  svSetScope(prev);
 }
 
 extern "C" void command_init(const char command[]) {
-  strcpy(fifo, command);
-  tail = strlen(command);
+  console_inject(command);
+}
+
+#ifdef CHECKPOINT
+void uart_save(VerilatedSerialize &os) {
+  console_flush();
+  console_save(os);
+  os << divisor_latch << receive_interrupt << int_level;
+  os.write(&scratch, sizeof(scratch));
+}
+
+void uart_restore(VerilatedDeserialize &os) {
+  console_restore(os);
+  os >> divisor_latch >> receive_interrupt >> int_level;
+  int_dirty = true;
+  os.read(&scratch, sizeof(scratch));
 }
+#endif
@@ -0,0 +1,213 @@
+package sim.peripheral.virtio
+
+import chisel3._
+import chisel3.util._
+import chipsalliance.rocketchip.config._
+
+import utils._
+import sim.SimParams
+
+class VirtioRead(implicit val p: Parameters) extends BlackBox with HasBlackBoxInline with SimParams {
+  val io = IO(new Bundle {
+    val clock = Input (Clock())
+    val ren   = Input (Bool())
+    val addr  = Input (UInt(16.W))
+    val rdata = Output(UInt(32.W))
+  })
+
+  setInline("VirtioRead.v",s"""
+    |import "DPI-C" function void virtio_read(input int addr, output int rdata);
+    |
+    |module VirtioRead (
+    |  input  clock,
+    |  input  ren,
+    |  input  [15:0] addr,
+    |  output reg [31:0] rdata
+    |);
+    |
+    |  always@(posedge clock) begin
+    |    if (ren) virtio_read({16'b0, addr}, rdata);
+    |  end
+    |
+    |endmodule
+  """.stripMargin)
+}
+
+class VirtioWrite(implicit val p: Parameters) extends BlackBox with HasBlackBoxInline with SimParams {
+  val io = IO(new Bundle {
+    val clock = Input (Clock())
+    val wen   = Input (Bool())
+    val waddr = Input (UInt(16.W))
+    val wdata = Input (UInt(32.W))
+  })
+
+  setInline("VirtioWrite.v", s"""
+    |import "DPI-C" function void virtio_write(input int addr, input int data);
+    |
+    |module VirtioWrite (
+    |  input clock,
+    |  input wen,
+    |  input [15:0] waddr,
+    |  input [31:0] wdata
+    |);
+    |
+    |  always@(posedge clock) begin
+    |    if (wen) virtio_write({16'b0, waddr}, wdata);
+    |  end
+    |
+    |endmodule
+  """.stripMargin)
+}
+
+// Like UartInt, the line is only written from C++, through virtio_set_int,
+// when the interrupt status of a device changes.
+class VirtioInt(implicit val p: Parameters) extends BlackBox with HasBlackBoxInline with SimParams {
+  val io = IO(new Bundle {
+    val inter = Output(Bool())
+  })
+
+  setInline("VirtioInt.v", s"""
+    |import "DPI-C" context function void virtio_int_init();
+    |
+    |module VirtioInt (
+    |  output reg inter
+    |);
+    |
+    |  export "DPI-C" function virtio_set_int;
+    |  function void virtio_set_int(input bit level);
+    |    inter = level;
+    |  endfunction
+    |
+    |  initial begin
+    |    inter = 0;
+    |    virtio_int_init();
+    |  end
+    |
+    |endmodule
+  """.stripMargin)
+}
+
+// Guest memory is only touched once the DCache has been written back and
+// invalidated. virtio.cpp raises `want` through virtio_set_flush when a queue
+// was notified or console input is waiting, and does the work in
+// virtio_flushed on the cycle the DCache acknowledges.
+class VirtioFlush(implicit val p: Parameters) extends BlackBox with HasBlackBoxInline with SimParams {
+  val io = IO(new Bundle {
+    val clock = Input (Clock())
+    val done  = Input (Bool())
+    val want  = Output(Bool())
+  })
+
+  setInline("VirtioFlush.v", s"""
+    |import "DPI-C" context function void virtio_flush_init();
+    |import "DPI-C" function void virtio_flushed();
+    |
+    |module VirtioFlush (
+    |  input clock,
+    |  input done,
+    |  output reg want
+    |);
+    |
+    |  export "DPI-C" function virtio_set_flush;
+    |  function void virtio_set_flush(input bit level);
+    |    want = level;
+    |  endfunction
+    |
+    |  initial begin
+    |    want = 0;
+    |    virtio_flush_init();
+    |  end
+    |
+    |  always@(posedge clock) begin
+    |    if (done) virtio_flushed();
+    |  end
+    |
+    |endmodule
+  """.stripMargin)
+}
+
+class VirtioIO(implicit p: Parameters) extends AxiSlaveIO {
+  val interrupt = Output(Bool())    // used buffer or config change (active-high)
+}
+
+// virtio-mmio registers of every device, one 4KB window each. The devices
+// themselves live in virtio.cpp.
+class Virtio(implicit val p: Parameters) extends RawModule with SimParams {
+  val io = IO(new VirtioIO {
+    val flush = if (useDmaFlush) Irrevocable(UInt(0.W)) else null // write back and invalidate the DCache
+  })
+  io.channel.b.bits.resp := 0.U
+  io.channel.b.bits.user := DontCare
+
+  io.channel.r.bits.last := 1.B
+  io.channel.r.bits.user := DontCare
+  io.channel.r.bits.resp := 0.U
+
+  withClockAndReset(io.basic.ACLK, !io.basic.ARESETn) {
+    val AWREADY = RegInit(1.B); io.channel.aw.ready := AWREADY
+    val WREADY  = RegInit(0.B); io.channel.w .ready := WREADY
+    val BVALID  = RegInit(0.B); io.channel.b .valid := BVALID
+    val ARREADY = RegInit(1.B); io.channel.ar.ready := ARREADY
+    val RVALID  = RegInit(0.B); io.channel.r .valid := RVALID
+
+    val RID    = RegInit(0.U(idlen.W)); io.channel.r.bits.id := RID
+    val BID    = RegInit(0.U(idlen.W)); io.channel.b.bits.id := BID
+    val ARADDR = RegInit(0.U(16.W))
+    val AWADDR = RegInit(0.U(16.W))
+
+    val wireARADDR = WireDefault(UInt(16.W), ARADDR)
+
+    val virtio_read = Module(new VirtioRead)
+    virtio_read.io.clock   := io.basic.ACLK
+    virtio_read.io.ren     := 0.B
+    virtio_read.io.addr    := wireARADDR
+    io.channel.r.bits.data := VecInit((0 until 8).map { i => virtio_read.io.rdata << (8 * i) })(ARADDR(2, 0))
+
+    val virtio_write = Module(new VirtioWrite)
+    virtio_write.io.clock := io.basic.ACLK
+    virtio_write.io.wen   := 0.B
+    virtio_write.io.waddr := AWADDR
+    virtio_write.io.wdata := VecInit((0 until 8).map { i => io.channel.w.bits.data >> (8 * i) })(AWADDR(2, 0))
+
+    val virtio_int = Module(new VirtioInt)
+    io.interrupt := virtio_int.io.inter
+
+    if (useDmaFlush) {
+      val virtio_flush = Module(new VirtioFlush)
+      virtio_flush.io.clock := io.basic.ACLK
+      virtio_flush.io.done  := io.flush.fire
+      io.flush.valid := virtio_flush.io.want
+      io.flush.bits  := DontCare
+    }
+
+    when(io.channel.r.fire) {
+      RVALID  := 0.B
+      ARREADY := 1.B
+    }.elsewhen(io.channel.ar.fire) {
+      virtio_read.io.ren := 1.B
+      wireARADDR := io.channel.ar.bits.addr - VIRTIO.BASE.U
+      ARADDR  := wireARADDR
+      RID     := io.channel.ar.bits.id
+      ARREADY := 0.B
+      RVALID  := 1.B
+    }
+
+    when(io.channel.aw.fire) {
+      AWADDR  := io.channel.aw.bits.addr - VIRTIO.BASE.U
+      BID     := io.channel.aw.bits.id
+      AWREADY := 0.B
+      WREADY  := 1.B
+    }
+
+    when(io.channel.w.fire) {
+      virtio_write.io.wen := 1.B
+      WREADY := 0.B
+      BVALID := 1.B
+    }
+
+    when(io.channel.b.fire) {
+      AWREADY := 1.B
+      BVALID  := 0.B
+    }
+  }
+}
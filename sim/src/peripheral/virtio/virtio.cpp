@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <svdpi.h>
+#include <debug.hpp>
+#include <disk.hpp>
+#include <console.hpp>
+#include <sim_main.hpp>
+
+// https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html
+//
+// virtio-mmio (version 2) devices, one per 4KB window:
+//   0  virtio-blk on the image given by --virtio-blk, or a placeholder
+//      (device ID 0) without one
+//   1  virtio-console on the shared console, receiveq 0 and transmitq 1
+//
+// Split virtqueues are processed on QueueNotify, and the receiveq whenever
+// console input is waiting, with descriptors, rings and buffers read and
+// written straight out of pmem. When the SoC has the DCache flush port
+// (VirtioFlush), the work waits until the DCache has been written back and
+// invalidated, so the guest needs no cache maintenance, as with any coherent
+// DMA. Everything written to guest memory is mirrored to the REF.
+
+#define VIRTIO_MAGIC  0x74726976 // "virt"
+#define VIRTIO_VENDOR 0x554d4551 // "QEMU", so Linux applies no quirks
+#define VIRTIO_NR_DEV 2
+#define VIRTQ_MAX     2
+#define VIRTQ_NUM_MAX 256
+
+enum {
+  MagicValue       = 0x000, Version          = 0x004, DeviceID        = 0x008, VendorID          = 0x00c,
+  DeviceFeatures   = 0x010, DeviceFeaturesSel = 0x014,
+  DriverFeatures   = 0x020, DriverFeaturesSel = 0x024,
+  QueueSel         = 0x030, QueueNumMax      = 0x034, QueueNum        = 0x038, QueueReady        = 0x044,
+  QueueNotify      = 0x050, InterruptStatus  = 0x060, InterruptACK    = 0x064, Status            = 0x070,
+  QueueDescLow     = 0x080, QueueDescHigh    = 0x084, QueueDriverLow  = 0x090, QueueDriverHigh   = 0x094,
+  QueueDeviceLow   = 0x0a0, QueueDeviceHigh  = 0x0a4, ConfigGeneration = 0x0fc, Config           = 0x100
+};
+
+enum { VIRTIO_BLK, VIRTIO_CONSOLE };
+enum { VIRTIO_ID_NONE = 0, VIRTIO_ID_BLOCK = 2, VIRTIO_ID_CONSOLE = 3 };
+enum { CONSOLE_RX = 0, CONSOLE_TX = 1 };
+
+#define VIRTIO_F_VERSION_1 (1ULL << 32)
+#define VIRTIO_BLK_F_FLUSH (1ULL << 9)
+
+enum { STATUS_FEATURES_OK = 8, STATUS_DRIVER_OK = 4, STATUS_NEEDS_RESET = 64 };
+enum { INT_USED = 1, INT_CONFIG = 2 };
+enum { VIRTQ_DESC_F_NEXT = 1, VIRTQ_DESC_F_WRITE = 2 };
+enum { VIRTQ_AVAIL_F_NO_INTERRUPT = 1 };
+enum { VIRTIO_BLK_T_IN = 0, VIRTIO_BLK_T_OUT = 1, VIRTIO_BLK_T_FLUSH = 4, VIRTIO_BLK_T_GET_ID = 8 };
+enum { VIRTIO_BLK_S_OK = 0, VIRTIO_BLK_S_IOERR = 1, VIRTIO_BLK_S_UNSUPP = 2 };
+
+struct virtq_desc_t { uint64_t addr; uint32_t len; uint16_t flags, next; };
+struct virtio_blk_req_t { uint32_t type, reserved; uint64_t sector; };
+
+struct virtq_t {
+  uint32_t num, ready;
+  uint64_t desc, avail, used;
+  uint16_t last_avail, used_idx;
+};
+
+struct virtio_dev_t {
+  uint32_t id, nr_queue;
+  uint64_t features, driver_features;
+  uint32_t features_sel, driver_features_sel, queue_sel;
+  uint32_t status, int_status;
+  virtq_t q[VIRTQ_MAX];
+};
+
+// A descriptor chain, split into the part the driver filled in and the part
+// the device writes. `written` becomes the length in the used ring.
+struct seg_t { uint64_t addr; uint8_t *p; uint32_t len; };
+struct chain_t {
+  seg_t rd[VIRTQ_NUM_MAX], wr[VIRTQ_NUM_MAX];
+  int nr_rd, nr_wr;
+  uint64_t rd_len, wr_len, written;
+};
+
+static virtio_dev_t dev[VIRTIO_NR_DEV];
+static chain_t chain;
+static disk_t blk = {};
+static const char *blk_file = NULL, *blk_overlay = NULL;
+
+// Level of the VirtioInt line as last written through virtio_set_int.
+static svScope int_scope = NULL;
+static bool int_level = false, int_dirty = false;
+extern "C" void virtio_set_int(svBit level);
+
+// Queues waiting for the DCache flush, a bit per queue, and the level of the
+// VirtioFlush request as last written through virtio_set_flush. Without
+// that port (flush_scope unset), queues are processed at once.
+static svScope flush_scope = NULL;
+static uint32_t notified[VIRTIO_NR_DEV];
+static bool flush_level = false;
+extern "C" void virtio_set_flush(svBit level);
+
+// The receiveq ran out of buffers with input still waiting. It is not tried
+// again until the driver adds some and notifies.
+static bool rx_blocked = false;
+
+static inline void dma_written(uint64_t addr, void *p, uint64_t n) {
+#ifdef DIFFTEST
+  difftest_dma(addr, p, n);
+#endif
+}
+
+static inline uint64_t min(uint64_t a, uint64_t b) { return a < b ? a : b; }
+
+static void virtio_reset(int d) {
+  virtio_dev_t &v = dev[d];
+  uint32_t id = v.id, nr_queue = v.nr_queue;
+  uint64_t features = v.features;
+  memset(&v, 0, sizeof(v));
+  v.id = id;
+  v.nr_queue = nr_queue;
+  v.features = features;
+  int_dirty = true;
+}
+
+static void needs_reset(int d, const char *why) {
+  printf("virtio device %d: %s\n", d, why);
+  dev[d].status |= STATUS_NEEDS_RESET;
+  dev[d].int_status |= INT_CONFIG;
+  int_dirty = true;
+}
+
+static bool chain_get(const virtq_t &q, uint16_t head, chain_t *c) {
+  c->nr_rd = c->nr_wr = 0;
+  c->rd_len = c->wr_len = c->written = 0;
+  uint16_t i = head;
+  for (uint32_t n = 0; n < q.num; n++) {
+    if (i >= q.num) return false;
+    virtq_desc_t *d = (virtq_desc_t *)ram_dma(q.desc + (uint64_t)i * sizeof(virtq_desc_t), sizeof(virtq_desc_t));
+    if (!d) return false;
+    seg_t s = { d->addr, ram_dma(d->addr, d->len), d->len };
+    if (!s.p) return false;
+    if (d->flags & VIRTQ_DESC_F_WRITE) {
+      c->wr[c->nr_wr++] = s;
+      c->wr_len += s.len;
+    } else {
+      if (c->nr_wr) return false; // readable after writable
+      c->rd[c->nr_rd++] = s;
+      c->rd_len += s.len;
+    }
+    if (!(d->flags & VIRTQ_DESC_F_NEXT)) return true;
+    i = d->next;
+  }
+  return false; // loops
+}
+
+// Copy `n` bytes from offset `off` of the readable part. Returns the bytes copied.
+static uint64_t chain_read(const chain_t *c, uint64_t off, void *buf, uint64_t n) {
+  uint64_t done = 0;
+  for (int i = 0; i < c->nr_rd && done < n; i++) {
+    const seg_t &s = c->rd[i];
+    if (off >= s.len) { off -= s.len; continue; }
+    uint64_t k = min(s.len - off, n - done);
+    memcpy((uint8_t *)buf + done, s.p + off, k);
+    done += k;
+    off = 0;
+  }
+  return done;
+}
+
+// Copy `n` bytes to offset `off` of the writable part. Returns the bytes copied.
+static uint64_t chain_write(chain_t *c, uint64_t off, const void *buf, uint64_t n) {
+  uint64_t done = 0;
+  for (int i = 0; i < c->nr_wr && done < n; i++) {
+    const seg_t &s = c->wr[i];
+    if (off >= s.len) { off -= s.len; continue; }
+    uint64_t k = min(s.len - off, n - done);
+    memcpy(s.p + off, (const uint8_t *)buf + done, k);
+    dma_written(s.addr + off, s.p + off, k);
+    done += k;
+    off = 0;
+  }
+  c->written += done;
+  return done;
+}
+
+static void blk_request(chain_t *c) {
+  virtio_blk_req_t req;
+  uint8_t status = VIRTIO_BLK_S_OK;
+  if (!c->wr_len) return;
+  if (chain_read(c, 0, &req, sizeof(req)) != sizeof(req)) status = VIRTIO_BLK_S_IOERR;
+  else switch (req.type) {
+    case VIRTIO_BLK_T_IN:
+      for (uint64_t off = 0; off < c->wr_len - 1; off += SECTOR_SIZE) {
+        uint8_t *sec = disk_sector(&blk, req.sector + off / SECTOR_SIZE, false);
+        if (!sec) { status = VIRTIO_BLK_S_IOERR; break; }
+        chain_write(c, off, sec, min(SECTOR_SIZE, c->wr_len - 1 - off));
+      }
+      break;
+    case VIRTIO_BLK_T_OUT:
+      for (uint64_t off = 0; off < c->rd_len - sizeof(req); off += SECTOR_SIZE) {
+        uint8_t *sec = disk_sector(&blk, req.sector + off / SECTOR_SIZE, true);
+        if (!sec) { status = VIRTIO_BLK_S_IOERR; break; }
+        chain_read(c, sizeof(req) + off, sec, min(SECTOR_SIZE, c->rd_len - sizeof(req) - off));
+      }
+      break;
+    case VIRTIO_BLK_T_FLUSH: break; // the overlay is a shared mapping already
+    case VIRTIO_BLK_T_GET_ID: {
+      char id[20] = "yuquan-virtio-blk";
+      chain_write(c, 0, id, min(sizeof(id), c->wr_len - 1));
+      break;
+    }
+    default: status = VIRTIO_BLK_S_UNSUPP;
+  }
+  chain_write(c, c->wr_len - 1, &status, 1);
+}
+
+static void console_tx(const chain_t *c) {
+  for (int i = 0; i < c->nr_rd; i++)
+    for (uint32_t j = 0; j < c->rd[i].len; j++) console_putc(c->rd[i].p[j]);
+}
+
+static void console_rx(chain_t *c) {
+  char buf[4096];
+  uint64_t n = 0;
+  while (n < min(c->wr_len, sizeof(buf)) && console_getc(&buf[n])) n++;
+  chain_write(c, 0, buf, n);
+}
+
+static void virtq_process(int d, int qi) {
+  virtio_dev_t &v = dev[d];
+  virtq_t &q = v.q[qi];
+  bool rx = d == VIRTIO_CONSOLE && qi == CONSOLE_RX;
+  if (rx) rx_blocked = true;
+  if (!q.ready || !q.num || !(v.status & STATUS_DRIVER_OK) || (v.status & STATUS_NEEDS_RESET)) return;
+  uint16_t *avail = (uint16_t *)ram_dma(q.avail, 6 + 2 * q.num);
+  uint8_t *used = ram_dma(q.used, 6 + 8 * q.num);
+  if (!avail || !used) return needs_reset(d, "virtqueue is out of memory");
+  bool any = false;
+  while (q.last_avail != avail[1]) {
+    if (rx && console_empty()) break;
+    uint16_t head = avail[2 + q.last_avail % q.num];
+    if (!chain_get(q, head, &chain)) return needs_reset(d, "bad descriptor chain");
+    if (d == VIRTIO_BLK) blk_request(&chain);
+    else if (qi == CONSOLE_TX) console_tx(&chain);
+    else console_rx(&chain);
+    uint32_t elem[2] = { head, (uint32_t)chain.written };
+    uint8_t *slot = used + 4 + 8 * (q.used_idx % q.num);
+    memcpy(slot, elem, sizeof(elem));
+    dma_written(q.used + (slot - used), slot, sizeof(elem));
+    q.used_idx++;
+    memcpy(used + 2, &q.used_idx, 2);
+    dma_written(q.used + 2, used + 2, 2);
+    q.last_avail++;
+    any = true;
+  }
+  if (rx) rx_blocked = !console_empty();
+  if (any && !(avail[0] & VIRTQ_AVAIL_F_NO_INTERRUPT)) {
+    v.int_status |= INT_USED;
+    int_dirty = true;
+  }
+}
+
+static void virtq_notify(int d, int qi) {
+  if (d == VIRTIO_CONSOLE && qi == CONSOLE_RX) rx_blocked = false;
+  if (flush_scope) notified[d] |= 1U << qi;
+  else virtq_process(d, qi);
+}
+
+static uint32_t config_read(int d, uint32_t off) {
+  uint8_t config[8] = {};
+  if (d == VIRTIO_BLK) memcpy(config, &blk.nr_sector, 8); // capacity in 512-byte sectors
+  uint32_t data = 0;
+  if (off < sizeof(config)) memcpy(&data, config + off, min(4, sizeof(config) - off));
+  return data;
+}
+
+// `addr` is the offset in the window of all devices. Config space may be
+// read at any width, so reads return the 4 bytes starting at `addr`.
+extern "C" void virtio_read(uint32_t addr, uint32_t *rdata) {
+  int d = (addr >> 12) % VIRTIO_NR_DEV;
+  uint32_t off = addr & 0xfff;
+  virtio_dev_t &v = dev[d];
+  virtq_t *q = v.queue_sel < v.nr_queue ? &v.q[v.queue_sel] : NULL;
+  if (off >= Config) { *rdata = config_read(d, off - Config); return; }
+  switch (off) {
+    case MagicValue:      *rdata = VIRTIO_MAGIC; break;
+    case Version:         *rdata = 2; break;
+    case DeviceID:        *rdata = v.id; break;
+    case VendorID:        *rdata = VIRTIO_VENDOR; break;
+    case DeviceFeatures:  *rdata = v.features_sel < 2 ? v.features >> (32 * v.features_sel) : 0; break;
+    case QueueNumMax:     *rdata = q ? VIRTQ_NUM_MAX : 0; break;
+    case QueueReady:      *rdata = q ? q->ready : 0; break;
+    case InterruptStatus: *rdata = v.int_status; break;
+    case Status:          *rdata = v.status; break;
+    default:              *rdata = 0; break;
+  }
+}
+
+static inline void set_half(uint64_t &reg, int high, uint32_t val) {
+  reg = high ? (reg & 0xffffffffULL) | ((uint64_t)val << 32) : (reg & ~0xffffffffULL) | val;
+}
+
+extern "C" void virtio_write(uint32_t addr, uint32_t wdata) {
+  int d = (addr >> 12) % VIRTIO_NR_DEV;
+  uint32_t off = addr & 0xfff;
+  virtio_dev_t &v = dev[d];
+  virtq_t *q = v.queue_sel < v.nr_queue ? &v.q[v.queue_sel] : NULL;
+  if (!v.id) return;
+  switch (off) {
+    case DeviceFeaturesSel: v.features_sel = wdata; break;
+    case DriverFeatures:    if (v.driver_features_sel < 2) set_half(v.driver_features, v.driver_features_sel, wdata); break;
+    case DriverFeaturesSel: v.driver_features_sel = wdata; break;
+    case QueueSel:          v.queue_sel = wdata; break;
+    case QueueNum:          if (q && wdata <= VIRTQ_NUM_MAX) q->num = wdata; break;
+    case QueueReady:        if (q) q->ready = wdata & 1; break;
+    case QueueDescLow:      if (q) set_half(q->desc, 0, wdata); break;
+    case QueueDescHigh:     if (q) set_half(q->desc, 1, wdata); break;
+    case QueueDriverLow:    if (q) set_half(q->avail, 0, wdata); break;
+    case QueueDriverHigh:   if (q) set_half(q->avail, 1, wdata); break;
+    case QueueDeviceLow:    if (q) set_half(q->used, 0, wdata); break;
+    case QueueDeviceHigh:   if (q) set_half(q->used, 1, wdata); break;
+    case QueueNotify:       if (wdata < v.nr_queue) virtq_notify(d, wdata); break;
+    case InterruptACK:      v.int_status &= ~wdata; int_dirty = true; break;
+    case Status:
+      if (wdata == 0) { virtio_reset(d); break; } // queued notifies find no DRIVER_OK
+      // only what was offered can be accepted, and VERSION_1 must be
+      if ((wdata & STATUS_FEATURES_OK) && ((v.driver_features & ~v.features) || !(v.driver_features & VIRTIO_F_VERSION_1)))
+        wdata &= ~STATUS_FEATURES_OK;
+      v.status = wdata;
+      break;
+  }
+}
+
+extern "C" void virtio_set_blk(const char *file) {
+  blk_file = file;
+}
+
+extern "C" void virtio_set_blk_overlay(const char *file) {
+  blk_overlay = file;
+}
+
+extern "C" void virtio_init() {
+  memset(dev, 0, sizeof(dev));
+  if (blk_file) {
+    Assert(disk_open(&blk, blk_file, blk_overlay), "Can not open '%s'", blk_file);
+    dev[VIRTIO_BLK] = { VIRTIO_ID_BLOCK, 1, VIRTIO_F_VERSION_1 | VIRTIO_BLK_F_FLUSH };
+    printf(DEBUG "virtio-blk on %s\n", blk_file);
+  }
+  dev[VIRTIO_CONSOLE] = { VIRTIO_ID_CONSOLE, 2, VIRTIO_F_VERSION_1 }; // the console is started by uart_init/scan_init
+}
+
+extern "C" void virtio_int_init() {
+  int_scope = svGetScope();
+}
+
+extern "C" void virtio_flush_init() {
+  flush_scope = svGetScope();
+}
+
+// The DCache holds nothing now, so guest memory can be used directly.
+extern "C" void virtio_flushed() {
+  for (int d = 0; d < VIRTIO_NR_DEV; d++)
+    for (int qi = 0; qi < VIRTQ_MAX; qi++)
+      if (notified[d] & (1U << qi)) {
+        notified[d] &= ~(1U << qi);
+        virtq_process(d, qi);
+      }
+}
+
+// After every evaluation of the main loop: feeds waiting console input to the
+// receiveq, then brings the flush request and the interrupt line up to date.
+// A queued request stays up until virtio_flushed has run, as io.flush must.
+extern "C" void virtio_poll() {
+  const virtq_t &rx = dev[VIRTIO_CONSOLE].q[CONSOLE_RX];
+  if (rx.ready && !rx_blocked && !console_empty()) virtq_notify(VIRTIO_CONSOLE, CONSOLE_RX);
+  bool want = false;
+  for (int d = 0; d < VIRTIO_NR_DEV; d++) want |= notified[d] != 0;
+  if (want != flush_level && flush_scope) {
+    flush_level = want;
+    svScope prev = svSetScope(flush_scope);
+    virtio_set_flush(want);
+    svSetScope(prev);
+  }
+  if (!int_dirty) return;
+  int_dirty = false;
+  bool level = false;
+  for (int d = 0; d < VIRTIO_NR_DEV; d++) level |= dev[d].int_status != 0;
+  if (level == int_level || !int_scope) return;
+  int_level = level;
+  svScope prev = svSetScope(int_scope);
+  virtio_set_int(level);
+  svSetScope(prev);
+}
+
+#ifdef CHECKPOINT
+void virtio_save(VerilatedSerialize &os) {
+  os.write(dev, sizeof(dev));
+  os.write(notified, sizeof(notified));
+  os << int_level << flush_level << rx_blocked;
+  disk_save(os, &blk);
+}
+
+void virtio_restore(VerilatedDeserialize &os) {
+  os.read(dev, sizeof(dev));
+  os.read(notified, sizeof(notified));
+  os >> int_level >> flush_level >> rx_blocked;
+  int_dirty = true;
+  disk_restore(os, &blk);
+}
+#endif
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <sim_main.hpp>
+
+// Guest profiler. Every `interval` cycles the PC of the last commit is
+// counted, and with the call graph on, the stack of functions it is in.
+// That stack is a shadow stack kept from the commits: a jal/jalr linking
+// through ra or t0 is taken as a call, pushing a frame of the function it
+// was made from, and a frame is popped when the commit PC is its return
+// address. A sample is then those callers followed by the function of the
+// sampled PC. Traps and context switches are not seen, so the stacks are a
+// good guess, not the truth.
+
+struct symbol_t {
+  uint64_t addr, size;
+  std::string name;
+};
+
+struct frame_t {
+  uint64_t caller, ret;
+};
+
+#define MAX_DEPTH 256
+
+static const char *prefix = nullptr;
+static bool callgraph = false;
+static std::vector<symbol_t> symbols;
+static std::unordered_map<uint64_t, uint64_t> pc_hist;
+static std::unordered_map<std::string, uint64_t> stacks;
+static std::vector<frame_t> frames;
+static uint64_t nr_sample = 0;
+
+void profile_set_output(const char *file_prefix) {
+  prefix = file_prefix;
+}
+
+void profile_set_callgraph(bool on) {
+  callgraph = on;
+}
+
+// Function and untyped symbols of the text, sizeless ones reaching up to
+// the next symbol. Only ELF64 is read.
+void profile_add_elf(const char *file) {
+  int fd = open(file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", file);
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not stat '%s'", file);
+  uint8_t *p = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  Assert(p != MAP_FAILED, "Can not map '%s'", file);
+  close(fd);
+  Elf64_Ehdr *eh = (Elf64_Ehdr *)p;
+  Assert(!memcmp(eh->e_ident, ELFMAG, SELFMAG) && eh->e_ident[EI_CLASS] == ELFCLASS64, "'%s' is not an ELF64 file", file);
+  Elf64_Shdr *sh = (Elf64_Shdr *)(p + eh->e_shoff);
+  size_t before = symbols.size();
+  for (int i = 0; i < eh->e_shnum; i++) {
+    if (sh[i].sh_type != SHT_SYMTAB) continue;
+    Elf64_Sym *sym = (Elf64_Sym *)(p + sh[i].sh_offset);
+    const char *strtab = (const char *)(p + sh[sh[i].sh_link].sh_offset);
+    for (size_t j = 0; j < sh[i].sh_size / sizeof(Elf64_Sym); j++) {
+      int type = ELF64_ST_TYPE(sym[j].st_info);
+      if ((type != STT_FUNC && type != STT_NOTYPE) || !sym[j].st_name || sym[j].st_shndx == SHN_UNDEF ||
+          sym[j].st_shndx >= eh->e_shnum || !(sh[sym[j].st_shndx].sh_flags & SHF_EXECINSTR)) continue;
+      const char *name = strtab + sym[j].st_name;
+      if (name[0] == '.' || name[0] == '$') continue; // local labels and mapping symbols
+      symbols.push_back({ sym[j].st_value, sym[j].st_size, name });
+    }
+  }
+  munmap(p, st.st_size);
+  std::sort(symbols.begin(), symbols.end(), [](const symbol_t &a, const symbol_t &b) {
+    return a.addr < b.addr || (a.addr == b.addr && a.size > b.size);
+  });
+  symbols.erase(std::unique(symbols.begin(), symbols.end(), [](const symbol_t &a, const symbol_t &b) {
+    return a.addr == b.addr;
+  }), symbols.end());
+  printf(DEBUG "%ld symbols from %s\n", symbols.size() - before, file);
+}
+
+static const symbol_t *lookup(uint64_t pc) {
+  auto it = std::upper_bound(symbols.begin(), symbols.end(), pc, [](uint64_t pc, const symbol_t &s) {
+    return pc < s.addr;
+  });
+  if (it == symbols.begin()) return nullptr;
+  --it;
+  if (it->size && pc >= it->addr + it->size) return nullptr;
+  return &*it;
+}
+
+static std::string symbolize(uint64_t pc, bool offset) {
+  const symbol_t *s = lookup(pc);
+  char buf[32];
+  if (!s) {
+    snprintf(buf, sizeof(buf), "0x%lx", pc);
+    return buf;
+  }
+  if (!offset || pc == s->addr) return s->name;
+  snprintf(buf, sizeof(buf), "+0x%lx", pc - s->addr);
+  return s->name + buf;
+}
+
+void profile_commit(uint64_t pc, int rd, uint64_t rd_value, bool rvc) {
+  if (!callgraph) return;
+  for (size_t i = frames.size(); i-- > 0; )
+    if (frames[i].ret == pc) {
+      frames.resize(i);
+      break;
+    }
+  uint64_t next = pc + (rvc ? 2 : 4);
+  if ((rd == 1 || rd == 5) && rd_value == next) {
+    if (frames.size() == MAX_DEPTH) frames.erase(frames.begin());
+    frames.push_back({ pc, next });
+  }
+}
+
+void profile_sample(uint64_t pc) {
+  nr_sample++;
+  pc_hist[pc]++;
+  if (!callgraph) return;
+  std::string stack;
+  for (const frame_t &f : frames) {
+    stack += symbolize(f.caller, false);
+    stack += ';';
+  }
+  stack += symbolize(pc, false);
+  stacks[stack]++;
+}
+
+// PREFIX.flat has the functions and the hottest PCs by samples,
+// PREFIX.folded the stacks in the format of flamegraph.pl.
+void profile_write(void) {
+  if (!prefix || !nr_sample) return;
+  std::string file = std::string(prefix) + ".flat";
+  FILE *fp = fopen(file.c_str(), "w");
+  Assert(fp, "Can not open '%s'", file.c_str());
+  std::unordered_map<std::string, uint64_t> funcs;
+  std::vector<std::pair<uint64_t, uint64_t>> pcs;
+  for (auto &x : pc_hist) {
+    funcs[symbolize(x.first, false)] += x.second;
+    pcs.push_back({ x.second, x.first });
+  }
+  std::vector<std::pair<uint64_t, std::string>> flat;
+  for (auto &x : funcs) flat.push_back({ x.second, x.first });
+  std::sort(flat.rbegin(), flat.rend());
+  std::sort(pcs.rbegin(), pcs.rend());
+  fprintf(fp, "%ld samples\n\n%10s %7s %7s  %s\n", nr_sample, "samples", "%", "cum%", "function");
+  uint64_t cum = 0;
+  for (auto &x : flat) {
+    cum += x.first;
+    fprintf(fp, "%10ld %6.2f%% %6.2f%%  %s\n", x.first, 100.0 * x.first / nr_sample, 100.0 * cum / nr_sample, x.second.c_str());
+  }
+  fprintf(fp, "\n%10s %7s  %-18s  %s\n", "samples", "%", "pc", "symbol");
+  for (size_t i = 0; i < pcs.size() && i < 100; i++)
+    fprintf(fp, "%10ld %6.2f%%  0x%016lx  %s\n", pcs[i].first, 100.0 * pcs[i].first / nr_sample, pcs[i].second,
+            symbolize(pcs[i].second, true).c_str());
+  fclose(fp);
+  printf(DEBUG "Profile of %ld samples written to %s\n", nr_sample, file.c_str());
+  if (!callgraph) return;
+  file = std::string(prefix) + ".folded";
+  fp = fopen(file.c_str(), "w");
+  Assert(fp, "Can not open '%s'", file.c_str());
+  for (auto &x : stacks) fprintf(fp, "%s %ld\n", x.first.c_str(), x.second);
+  fclose(fp);
+  printf(DEBUG "Call stacks written to %s\n", file.c_str());
+}
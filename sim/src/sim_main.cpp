@@ -1,7 +1,12 @@
 #include "VTestTop.h"
 #include "verilated.h"
 #include "verilated_fst_c.h"
+#include <sys/wait.h>
 #include <sim_main.hpp>
+#include <guest_mem.hpp>
+#ifdef CHECKPOINT
+#include <checkpoint.hpp>
+#endif
 
 VerilatedContext *const contextp = new VerilatedContext;
 VTestTop *top = nullptr;
@@ -12,6 +17,137 @@ struct termios new_settings, stored_settings;
 uint64_t cycles = 0;
 static bool int_sig = false;
 static uint64_t no_commit = 0;
+static char *img_file = nullptr, *flash_file = nullptr, *storage_file = nullptr;
+static const char *stats_file = nullptr;
+static uint64_t max_cycles = 0, instrs = 0;
+static uint64_t profile_interval = 0;
+static struct timespec start_time;
+#ifdef CHECKPOINT
+static const char *ckpt_file = nullptr, *restore_file = nullptr;
+static uint64_t ckpt_cycle = 0;
+#endif
+#ifdef DIFFTEST
+static bool diff_async = false;
+static uint64_t diff_sweep = 0;
+#endif
+
+// With --snapshot=N, the simulator forks a copy of itself every N cycles,
+// which waits on a pipe doing nothing. Only the two newest are kept. When
+// the run fails, the older one is woken and runs again up to the failure,
+// with every commit printed and, with TRACE, the waveform on. Being the
+// older one, it starts N to 2N cycles before the failure. Otherwise they
+// are killed.
+struct snapshot_t { pid_t pid; int fd; uint64_t cycle; };
+static uint64_t snapshot_interval = 0;
+static snapshot_t snapshots[2];
+static int nr_snapshot = 0;
+static bool replaying = false;
+static uint64_t replay_end = 0;
+
+// With --server, the simulator sets up and resets once, optionally runs
+// IMAGE for --server-boot cycles, and then reads requests from stdin, one
+// per line:
+//
+//   IMAGE|- LOG|- STATS|- [INPUT]
+//
+// Each is run in a forked child, which loads IMAGE over guest memory, sends
+// INPUT to the console and writes its output to LOG and its numbers to
+// STATS. The server prints `start PID` when the child is forked and
+// `exit CODE` when it is done. After a boot, the caches hold lines of the
+// booted image, so IMAGE must be `-` then.
+static bool server = false;
+static uint64_t server_boot = 0;
+
+#ifdef TRACE
+// Tracing runs from --trace-begin, or from the first commit of --trace-pc
+// after it, to --trace-end. With --trace-window=N, it goes to two FST files
+// in /dev/shm instead, switching every N cycles, so the last N to 2N cycles
+// are always there. They are copied next to --trace-file only if the run
+// fails, and removed otherwise.
+static const char *trace_file = "dump.fst";
+static uint64_t trace_begin = 0, trace_end = UINT64_MAX, trace_pc = 0, trace_window = 0;
+static bool trace_pc_set = false, tracing = false, trace_done = false;
+static std::string trace_seg[2];
+static int trace_cur = 0;
+static uint64_t trace_seg_start = 0;
+static bool trace_opened = false, trace_rotated = false;
+
+static void trace_name_segments() {
+  const char *dir = access("/dev/shm", W_OK) ? "." : "/dev/shm";
+  char name[64];
+  for (int i = 0; i < 2; i++) {
+    snprintf(name, sizeof(name), "/yq-trace-%d-%d.fst", getpid(), i);
+    trace_seg[i] = std::string(dir) + name;
+  }
+}
+
+static void trace_open() {
+  if (!trace_window) {
+    tfp->open(trace_file);
+    return;
+  }
+  trace_seg_start = cycles;
+  trace_opened = true;
+  tfp->open(trace_seg[trace_cur].c_str());
+}
+
+static void trace_step() {
+  if (trace_done) return;
+  if (!tracing) {
+    if (cycles < trace_begin * 2) return;
+    if (trace_pc_set && !(top->io_wbValid && top->io_wbPC == trace_pc)) return;
+    printf(DEBUG "Tracing from %ld clock cycles.\n", cycles / 2);
+    trace_open();
+    tracing = true;
+  }
+  if (cycles >= trace_end * 2) {
+    tfp->close();
+    tracing = false;
+    trace_done = true;
+    printf(DEBUG "Tracing stopped at %ld clock cycles.\n", cycles / 2);
+    return;
+  }
+  if (trace_window && cycles - trace_seg_start >= trace_window * 2) {
+    tfp->close();
+    trace_cur ^= 1;
+    trace_rotated = true;
+    trace_open();
+  }
+  tfp->dump(contextp->time());
+}
+
+static void trace_copy(const char *from, const char *to) {
+  FILE *in = fopen(from, "rb"), *out = fopen(to, "wb");
+  Assert(in && out, "Can not copy the trace from %s to %s", from, to);
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, out);
+  fclose(in);
+  fclose(out);
+}
+
+static void trace_finish(bool failed) {
+  if (tracing) tfp->close();
+  tracing = false;
+  trace_done = true;
+  if (!trace_window) return;
+  if (failed && trace_opened) {
+    std::string base = trace_file;
+    size_t dot = base.rfind(".fst");
+    if (dot != std::string::npos) base.erase(dot);
+    if (trace_rotated) {
+      trace_copy(trace_seg[trace_cur ^ 1].c_str(), (base + ".0.fst").c_str());
+      trace_copy(trace_seg[trace_cur].c_str(), (base + ".1.fst").c_str());
+      printf(DEBUG "The last cycles are traced in %s.0.fst and %s.1.fst\n", base.c_str(), base.c_str());
+    } else {
+      trace_copy(trace_seg[trace_cur].c_str(), trace_file);
+      printf(DEBUG "The last cycles are traced in %s\n", trace_file);
+    }
+  }
+  unlink(trace_seg[0].c_str());
+  unlink(trace_seg[1].c_str());
+}
+#endif
 
 void int_handler(int sig) {
   if (sig != SIGINT) {
@@ -21,49 +157,525 @@ void int_handler(int sig) {
   int_sig = true;
 }
 
-void real_int_handler(void) {
+// The counters of utils/src/PERF.scala, as io_perf_* of the model.
+#define PERF_COUNTERS(_) _(cycles) _(instrs) _(icacheHit) _(icacheMiss) _(dcacheHit) _(dcacheMiss) _(dcacheWb) \
+  _(itlbMiss) _(dtlbMiss) _(tlbWalk) _(idStall) _(exStall) _(memStall) _(wbStall) _(loadUse) _(mulBusy) _(divBusy) \
+  _(cpiBase) _(cpiMemory) _(cpiMulDiv) _(cpiExecute) _(cpiLoadUse) _(cpiDepend) _(cpiFrontend) _(cpiOther)
+
+// Where a server child started, so that its stats leave out the boot.
+static uint64_t base_cycles = 0, base_instrs = 0;
+static struct {
+#define _(x) uint64_t x;
+  PERF_COUNTERS(_)
+#undef _
+} perf_base;
+#define PERF(x) ((uint64_t)top->io_perf_##x - perf_base.x)
+
+static void perf_rebase() {
+  base_cycles = cycles;
+  base_instrs = instrs;
+  no_commit = 0;
+#define _(x) perf_base.x = top->io_perf_##x;
+  PERF_COUNTERS(_)
+#undef _
+}
+
+// One JSON object per run, for the regression runner.
+static void stats_write(const char *result) {
+  if (!stats_file) return;
+  FILE *fp = fopen(stats_file, "w");
+  if (!fp) return;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double secs = (now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec) / 1e9;
+  uint64_t n = (cycles - base_cycles) / 2, i = instrs - base_instrs;
+  fprintf(fp, "{\"result\": \"%s\", \"cycles\": %lu, \"instrs\": %lu, \"ipc\": %.4f, \"host_seconds\": %.3f, \"sim_hz\": %.1f, \"perf\": {",
+          result, n, i, n ? (double)i / n : 0.0, secs, secs > 0 ? n / secs : 0.0);
+  const char *sep = "";
+#define _(x) fprintf(fp, "%s\"" #x "\": %lu", sep, PERF(x)); sep = ", ";
+  PERF_COUNTERS(_)
+#undef _
+  fprintf(fp, "}}\n");
+  fclose(fp);
+}
+
+static double percent(uint64_t a, uint64_t b) {
+  return b ? 100.0 * a / b : 0.0;
+}
+
+// The counters are kept by the CPU itself, from reset, and rebased when a
+// server child starts. Every cycle goes to exactly one entry of the CPI
+// stack, so the entries add up to the CPI.
+static void perf_report() {
+  uint64_t n = PERF(cycles), i = PERF(instrs);
+  uint64_t ic = PERF(icacheHit) + PERF(icacheMiss), dc = PERF(dcacheHit) + PERF(dcacheMiss);
+  printf(DEBUG "%ld instructions in %ld cycles, IPC %.3f.\n", i, n, n ? (double)i / n : 0.0);
+  printf(DEBUG "ICache: %ld accesses, %.2f%% misses. DCache: %ld accesses, %.2f%% misses, %ld writebacks.\n",
+         ic, percent(PERF(icacheMiss), ic), dc, percent(PERF(dcacheMiss), dc), PERF(dcacheWb));
+  printf(DEBUG "TLB: %ld ITLB and %ld DTLB misses, %ld cycles walking.\n",
+         PERF(itlbMiss), PERF(dtlbMiss), PERF(tlbWalk));
+  printf(DEBUG "Input held off: ID %ld, EX %ld, MEM %ld, WB %ld cycles; %ld load-use; multiplier %ld and divider %ld busy.\n",
+         PERF(idStall), PERF(exStall), PERF(memStall), PERF(wbStall), PERF(loadUse), PERF(mulBusy), PERF(divBusy));
+  if (!i) return;
+  printf(DEBUG "CPI stack:\n");
+#define _(x, name) printf(DEBUG "  %-10s %7.3f %6.2f%%\n", name, (double)PERF(x) / i, percent(PERF(x), n));
+  _(cpiBase, "base") _(cpiMemory, "memory") _(cpiMulDiv, "mul/div") _(cpiExecute, "execute")
+  _(cpiLoadUse, "load-use") _(cpiDepend, "depend") _(cpiFrontend, "frontend") _(cpiOther, "other")
+#undef _
+  printf(DEBUG "  %-10s %7.3f\n", "total", (double)n / i);
+}
+
+static void snapshot_kill(snapshot_t &s) {
+  kill(s.pid, SIGKILL);
+  close(s.fd);
+  waitpid(s.pid, NULL, 0);
+}
+
+// In the child. Threads do not survive fork(), so difftest goes back to
+// checking on this thread and the console stays quiet.
+static void snapshot_wait(int fd) {
+  for (int i = 0; i < nr_snapshot; i++) close(snapshots[i].fd);
+  nr_snapshot = 0;
+  signal(SIGINT, SIG_IGN);
+  uint64_t end;
+  if (read(fd, &end, sizeof(end)) != sizeof(end)) _exit(0);
+  close(fd);
+  signal(SIGINT, int_handler);
+  replaying = true;
+  replay_end = end;
+  snapshot_interval = 0;
+  stats_file = nullptr;
+#ifdef CHECKPOINT
+  ckpt_file = nullptr;
+#endif
+  console_mute();
+#ifdef DIFFTEST
+  difftest_start(false, diff_sweep);
+#endif
+  printf(DEBUG "Replaying from %ld clock cycles.\n", cycles / 2);
+}
+
+// Taken on the falling edge, like checkpoints.
+static void snapshot_take() {
+  int fds[2];
+  Assert(pipe(fds) == 0, "Can not create a pipe for the snapshot");
+#ifdef DIFFTEST
+  difftest_drain();
+#endif
+  pid_t pid = fork();
+  Assert(pid >= 0, "Can not fork a snapshot");
+  if (pid == 0) {
+    close(fds[1]);
+    snapshot_wait(fds[0]);
+    return;
+  }
+  close(fds[0]);
+  if (nr_snapshot == 2) {
+    snapshot_kill(snapshots[0]);
+    snapshots[0] = snapshots[1];
+    nr_snapshot = 1;
+  }
+  snapshots[nr_snapshot++] = { pid, fds[1], cycles };
+}
+
+static void snapshot_finish(bool failed) {
+  if (!nr_snapshot) return;
+  snapshot_t s = snapshots[0];
+  for (int i = failed ? 1 : 0; i < nr_snapshot; i++) snapshot_kill(snapshots[i]);
+  nr_snapshot = 0;
+  if (!failed) return;
+  printf(DEBUG "Replaying the last %ld clock cycles from the snapshot.\n", (cycles - s.cycle) / 2);
+  uint64_t end = cycles;
+  if (write(s.fd, &end, sizeof(end)) != sizeof(end)) kill(s.pid, SIGKILL);
+  close(s.fd);
+  waitpid(s.pid, NULL, 0);
+}
+
+#ifdef DIFFTEST
+// Spike's memory starts out zeroed, so only what the RAM model loaded is
+// copied. In a server child it holds what the DUT's does.
+static void difftest_load(uint8_t *mem) {
+  uint64_t off, size;
+  for (int i = 0; ram_loaded(i, &off, &size); i++)
+    if (off < DIFF_PMEM_SIZE)
+      difftest_memcpy(0x80000000UL + off, mem + off,
+                      (size < DIFF_PMEM_SIZE - off) ? size : DIFF_PMEM_SIZE - off, DIFFTEST_TO_REF);
+}
+#endif
+
+static void serve_child(char *img, const char *log, const char *stats, const char *input) {
+  int fd = open("/dev/null", O_RDONLY);
+  dup2(fd, STDIN_FILENO);
+  close(fd);
+  if (strcmp(log, "-")) {
+    fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    Assert(fd >= 0, "Can not open '%s'", log);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+  }
+  server = false;
+  stats_file = strcmp(stats, "-") ? strdup(stats) : nullptr;
+  console_restart();
+  if (strcmp(img, "-")) {
+    img_file = strdup(img);
+    ram_load(img_file);
+    sdcard_init(img_file);
+#ifdef DIFFTEST
+    difftest_load(ram_dma(0x80000000UL, 0));
+#endif
+  }
+  if (*input) command_init((std::string(input) + "\n").c_str());
+#ifdef DIFFTEST
+  difftest_start(diff_async, diff_sweep);
+#endif
+#ifdef TRACE
+  if (trace_window) trace_name_segments();
+#endif
+  perf_rebase();
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+// Returns only in a child. Threads do not survive fork(), so the difftest
+// checker is stopped here and started again by each child.
+static void serve() {
+  console_flush();
+#ifdef DIFFTEST
+  difftest_drain();
+  difftest_stop();
+#endif
+  printf(DEBUG "Serving requests after %ld clock cycles.\n", cycles / 2);
+  char line[4096], img[1024], log[1024], stats[1024];
+  while (!int_sig && fgets(line, sizeof(line), stdin)) {
+    int n = 0;
+    if (sscanf(line, "%1023s %1023s %1023s %n", img, log, stats, &n) < 3) {
+      printf("error bad request\n");
+      continue;
+    }
+    if (server_boot && strcmp(img, "-")) {
+      printf("error no image after --server-boot\n");
+      continue;
+    }
+    char *input = line + n;
+    input[strcspn(input, "\n")] = '\0';
+    pid_t pid = fork();
+    Assert(pid >= 0, "Can not fork a server child");
+    if (pid == 0) {
+      serve_child(img, log, stats, input);
+      return;
+    }
+    printf("start %d\n", pid);
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    printf("exit %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+  }
+  tcsetattr(0, TCSAFLUSH, &stored_settings);
+  exit(0);
+}
+
+void real_int_handler(const char *result) {
   tcsetattr(0, TCSAFLUSH, &stored_settings);
   setlinebuf(stdout);
   setlinebuf(stderr);
-  scan_uart(_isRunning) = false;
+  console_flush();
+#ifdef DIFFTEST
+  if (difftest_drain()) difftest_report();
+  difftest_stop();
+#endif
 #ifdef TRACE
-  tfp->close();
+  trace_finish(!strcmp(result, "stuck"));
 #endif
   printf("\n" DEBUG "Exit at PC = " FMT_WORD " after %ld clock cycles.\n", top->io_wbPC, cycles / 2);
+  dram_report();
+  perf_report();
+  stats_write(result);
+  profile_write();
+  snapshot_finish(!strcmp(result, "stuck"));
   exit(0);
 }
 
+static void parse_args(int argc, char **argv) {
+  const struct option table[] = {
+    {"hugepage"        , required_argument, NULL, 'H'},
+    {"console"         , required_argument, NULL, 'o'},
+    {"sd-overlay"      , required_argument, NULL, 'O'},
+    {"virtio-blk"      , required_argument, NULL, 'v'},
+    {"virtio-overlay"  , required_argument, NULL, 'V'},
+    {"dram"            , required_argument, NULL, 'm'},
+    {"dram-latency"    , required_argument, NULL, 'l'},
+    {"dram-beat"       , required_argument, NULL, 'b'},
+    {"dram-banks"      , required_argument, NULL, 'k'},
+    {"dram-row"        , required_argument, NULL, 'w'},
+    {"dram-row-miss"   , required_argument, NULL, 'x'},
+    {"dmac"            , required_argument, NULL, 'D'},
+    {"dmac-latency"    , required_argument, NULL, 'L'},
+    {"max-cycles"      , required_argument, NULL, 'T'},
+    {"stats"           , required_argument, NULL, 'S'},
+    {"snapshot"        , required_argument, NULL, 'n'},
+    {"server"          , no_argument      , NULL, 'R'},
+    {"server-boot"     , required_argument, NULL, 'N'},
+    {"profile"         , required_argument, NULL, 'p'},
+    {"profile-elf"     , required_argument, NULL, 'e'},
+    {"profile-interval", required_argument, NULL, 'i'},
+    {"profile-calls"   , no_argument      , NULL, 'g'},
+#ifdef CHECKPOINT
+    {"checkpoint"      , required_argument, NULL, 'c'},
+    {"checkpoint-cycle", required_argument, NULL, 'C'},
+    {"restore"         , required_argument, NULL, 'r'},
+#endif
+#ifdef TRACE
+    {"trace-file"      , required_argument, NULL, 'f'},
+    {"trace-begin"     , required_argument, NULL, 'B'},
+    {"trace-end"       , required_argument, NULL, 'E'},
+    {"trace-pc"        , required_argument, NULL, 'P'},
+    {"trace-window"    , required_argument, NULL, 'W'},
+#endif
+#ifdef DIFFTEST
+    {"diff-async"      , no_argument      , NULL, 'a'},
+    {"diff-sweep"      , required_argument, NULL, 's'},
+#endif
+    {0                 , 0                , NULL,  0 },
+  };
+  int o;
+  bool overlay = false;
+  while ((o = getopt_long(argc, argv, "-", table, NULL)) != -1) {
+    switch (o) {
+      case 'H':
+        if (!strcmp(optarg, "thp")) ram_set_hugepage(HUGEPAGE_THP);
+        else if (!strcmp(optarg, "hugetlb")) ram_set_hugepage(HUGEPAGE_HUGETLB);
+        else panic("Unknown hugepage mode '%s'", optarg);
+        break;
+      case 'o': console_set_output(optarg); break;
+      case 'O': sdcard_set_overlay(optarg); overlay = true; break;
+      case 'v': virtio_set_blk(optarg); break;
+      case 'V': virtio_set_blk_overlay(optarg); overlay = true; break;
+      case 'm':
+        if (!strcmp(optarg, "ideal")) dram_config.model = DRAM_IDEAL;
+        else if (!strcmp(optarg, "fixed")) dram_config.model = DRAM_FIXED;
+        else if (!strcmp(optarg, "bank")) dram_config.model = DRAM_BANK;
+        else panic("Unknown DRAM model '%s'", optarg);
+        break;
+      case 'l': dram_config.latency  = atoi(optarg); break;
+      case 'b': dram_config.beat     = atoi(optarg); break;
+      case 'k': dram_config.banks    = atoi(optarg); break;
+      case 'w': dram_config.row      = atoi(optarg); break;
+      case 'x': dram_config.row_miss = atoi(optarg); break;
+      case 'D':
+        if (!strcmp(optarg, "axi")) dmac_set_functional(false);
+        else if (!strcmp(optarg, "functional")) dmac_set_functional(true);
+        else panic("Unknown DMAC mode '%s'", optarg);
+        break;
+      case 'L': dmac_set_latency(atoi(optarg)); break;
+      case 'T': max_cycles = strtoull(optarg, NULL, 0); break;
+      case 'S': stats_file = optarg; break;
+      case 'n': snapshot_interval = strtoull(optarg, NULL, 0); break;
+      case 'R': server = true; console_no_input(); break;
+      case 'N': server_boot = strtoull(optarg, NULL, 0); break;
+      case 'p': profile_set_output(optarg); if (!profile_interval) profile_interval = 100; break;
+      case 'e': profile_add_elf(optarg); break;
+      case 'i': profile_interval = strtoull(optarg, NULL, 0); break;
+      case 'g': profile_set_callgraph(true); break;
+#ifdef CHECKPOINT
+      case 'c': ckpt_file = optarg; break;
+      case 'C': ckpt_cycle = strtoull(optarg, NULL, 0); break;
+      case 'r': restore_file = optarg; break;
+#endif
+#ifdef TRACE
+      case 'f': trace_file = optarg; break;
+      case 'B': trace_begin = strtoull(optarg, NULL, 0); break;
+      case 'E': trace_end = strtoull(optarg, NULL, 0); break;
+      case 'P': trace_pc = strtoull(optarg, NULL, 0); trace_pc_set = true; break;
+      case 'W': trace_window = strtoull(optarg, NULL, 0); break;
+#endif
+#ifdef DIFFTEST
+      case 'a': diff_async = true; break;
+      case 's': diff_sweep = strtoull(optarg, NULL, 0); break;
+#endif
+      case 1:
+        if (optarg[0] == '+') break; // verilator plusargs
+        if (!img_file) img_file = optarg;
+        else if (!flash_file) flash_file = optarg;
+        else storage_file = optarg;
+        break;
+      default:
+        printf("Usage: %s [OPTION...] IMAGE [FLASH] [STORAGE]\n\n", argv[0]);
+        printf("\t--hugepage=thp|hugetlb    back guest memory with hugepages\n");
+        printf("\t--console=FILE            write the UART and virtio-console output to FILE\n");
+        printf("\t--sd-overlay=FILE         keep sdcard writes in FILE, leaving the image untouched\n");
+        printf("\t--virtio-blk=FILE         attach the disk image FILE as virtio-blk\n");
+        printf("\t--virtio-overlay=FILE     keep virtio-blk writes in FILE, leaving the image untouched\n");
+        printf("\t--dram=ideal|fixed|bank   DRAM timing model (default ideal)\n");
+        printf("\t--dram-latency=N          cycles to the first beat of a burst (default 20)\n");
+        printf("\t--dram-beat=N             cycles per beat (default 1)\n");
+        printf("\t--dram-banks=N            number of banks of the bank model (default 8)\n");
+        printf("\t--dram-row=BYTES          row size of the bank model (default 2048)\n");
+        printf("\t--dram-row-miss=N         extra cycles on a row miss (default 20)\n");
+        printf("\t--dmac=axi|functional     move DMAC data over the slave port or copy it at once (default axi)\n");
+        printf("\t--dmac-latency=N          cycles a functional DMAC transfer takes (default 0)\n");
+        printf("\t--max-cycles=N            give up after N clock cycles, exiting with 3\n");
+        printf("\t--stats=FILE              write the result, cycles, instructions and speed to FILE as JSON\n");
+        printf("\t--snapshot=N              fork a snapshot every N cycles, replayed if the run fails\n");
+        printf("\t--server                  set up once and run the requests read from stdin in forked children\n");
+        printf("\t--server-boot=N           run IMAGE for N clock cycles before serving\n");
+        printf("\t--profile=PREFIX          sample the PC, writing PREFIX.flat and, with --profile-calls, PREFIX.folded\n");
+        printf("\t--profile-elf=ELF         symbolize the profile with ELF, may be given more than once\n");
+        printf("\t--profile-interval=N      take a sample every N clock cycles (default 100)\n");
+        printf("\t--profile-calls           follow calls and returns for the folded stacks\n");
+#ifdef CHECKPOINT
+        printf("\t--checkpoint=FILE         save a checkpoint to FILE\n");
+        printf("\t--checkpoint-cycle=N      take the checkpoint after N clock cycles\n");
+        printf("\t--restore=FILE            resume from the checkpoint in FILE\n");
+#endif
+#ifdef TRACE
+        printf("\t--trace-file=FILE         write the waveform to FILE (default dump.fst)\n");
+        printf("\t--trace-begin=N           start tracing at clock cycle N\n");
+        printf("\t--trace-end=N             stop tracing at clock cycle N\n");
+        printf("\t--trace-pc=ADDR           start tracing when ADDR commits, after --trace-begin\n");
+        printf("\t--trace-window=N          keep only the last N to 2N cycles, saved if the run fails\n");
+#endif
+#ifdef DIFFTEST
+        printf("\t--diff-async              run Spike on a separate checker thread\n");
+        printf("\t--diff-sweep=N            compare only what each commit wrote, full state every N commits\n");
+#endif
+        printf("\n");
+        exit(1);
+    }
+  }
+  Assert(img_file || (server && !server_boot), "No image specified");
+  if (snapshot_interval) {
+    // the overlays are shared mappings, which a snapshot would see change
+    Assert(!overlay, "--snapshot can not be used with --sd-overlay or --virtio-overlay");
+#if defined(THREADS) && THREADS > 1
+    panic("--snapshot can not be used with THREADS=%d, the model threads do not survive fork()", THREADS);
+#endif
+#ifdef TRACE
+    Assert(!trace_window, "--snapshot can not be used with --trace-window");
+    // the replay traces everything from the snapshot on
+    Assert(!trace_begin && trace_end == UINT64_MAX && !trace_pc_set,
+           "--snapshot can not be used with --trace-begin, --trace-end or --trace-pc");
+#endif
+  }
+#if defined(THREADS) && THREADS > 1
+  if (server) panic("--server can not be used with THREADS=%d, the model threads do not survive fork()", THREADS);
+#endif
+#ifdef CHECKPOINT
+  Assert(!ckpt_file || ckpt_cycle, "--checkpoint requires --checkpoint-cycle");
+#endif
+}
+
+#ifdef CHECKPOINT
+#ifdef DIFFTEST
+static void difftest_save(VerilatedSerialize &os) {
+  size_t regs[50] = {};
+  difftest_drain();
+  difftest_regcpy(regs, DIFFTEST_TO_DUT);
+  os.write(regs, sizeof(regs));
+  uint8_t *buf = (uint8_t *)calloc(DIFF_PMEM_SIZE, 1);
+  difftest_memcpy(0x80000000UL, buf, DIFF_PMEM_SIZE, DIFFTEST_TO_DUT);
+  checkpoint_save_mem(os, buf, DIFF_PMEM_SIZE);
+  free(buf);
+}
+
+static void difftest_restore(VerilatedDeserialize &os) {
+  size_t regs[50];
+  os.read(regs, sizeof(regs));
+  difftest_regcpy(regs, DIFFTEST_TO_REF);
+  uint8_t *buf = (uint8_t *)calloc(DIFF_PMEM_SIZE, 1);
+  checkpoint_restore_mem(os, buf, DIFF_PMEM_SIZE);
+  difftest_memcpy(0x80000000UL, buf, DIFF_PMEM_SIZE, DIFFTEST_TO_REF);
+  free(buf);
+}
+#endif
+
+// Checkpoints are only taken on the falling edge, after the previous
+// half-cycle has been fully evaluated and all DPI side effects retired.
+static void checkpoint_save(const char *file) {
+  VerilatedSave os;
+  uint64_t magic = CKPT_MAGIC, time = contextp->time();
+  bool diff = false;
+#ifdef DIFFTEST
+  diff = true;
+#endif
+  os.open(file);
+  Assert(os.isOpen(), "Can not open '%s'", file);
+  os << magic << diff << cycles << no_commit << time;
+  os << *top;
+  ram_save(os);
+  dram_save(os);
+  uart_save(os);
+  sdcard_save(os);
+  virtio_save(os);
+#ifdef DIFFTEST
+  difftest_save(os);
+#endif
+  os.close();
+  printf(DEBUG "Checkpoint saved to %s after %ld clock cycles.\n", file, cycles / 2);
+}
+
+static void checkpoint_restore(const char *file) {
+  VerilatedRestore os;
+  uint64_t magic, time;
+  bool diff, want_diff = false;
+#ifdef DIFFTEST
+  want_diff = true;
+#endif
+  os.open(file);
+  Assert(os.isOpen(), "Can not open '%s'", file);
+  os >> magic >> diff;
+  Assert(magic == CKPT_MAGIC, "'%s' is not a checkpoint", file);
+  Assert(diff == want_diff, "'%s' was saved with DIFF=%d", file, diff);
+  os >> cycles >> no_commit >> time;
+  contextp->time(time);
+  top->eval(); // initial blocks, such as UartInt registering its DPI scope, only run on the first eval
+  os >> *top;
+  ram_restore(os);
+  dram_restore(os);
+  uart_restore(os);
+  sdcard_restore(os);
+  virtio_restore(os);
+#ifdef DIFFTEST
+  difftest_restore(os);
+#endif
+  os.close();
+  printf(DEBUG "Checkpoint restored from %s at %ld clock cycles.\n", file, cycles / 2);
+  if (ckpt_file && ckpt_cycle * 2 <= cycles) {
+    printf(DEBUG "Checkpoint cycle %ld is not after the restored one, ignored.\n", ckpt_cycle);
+    ckpt_file = nullptr;
+  }
+}
+#endif
+
 int main(int argc, char **argv, char **env) {
+  parse_args(argc, argv);
   top = new VTestTop;
 
 #ifdef DIFFTEST
   void *ram_param =
 #endif
-  ram_init(argv[1]);
-  sdcard_init(argv[1]);
+  ram_init(img_file);
+  dram_init();
+  if (img_file) sdcard_init(img_file);
+  virtio_init();
 
 #ifdef FLASH
-  flash_init(argv[2]);
+  flash_init(flash_file);
 #endif
 
 #ifdef STORAGE
-  storage_init(argv[3]);
+  storage_init(storage_file);
 #endif
 
 #ifdef DIFFTEST
-  vaddr_t pc, spike_pc;
   {
     size_t tmp[50] = {};
     difftest_init(0);
     difftest_regcpy(tmp, DIFFTEST_TO_DUT);
     tmp[32] = 0x80000000UL;
     difftest_regcpy(tmp, DIFFTEST_TO_REF);
-    difftest_memcpy(0x80000000UL, ram_param, PMEM_SIZE, DIFFTEST_TO_REF);
+    difftest_load((uint8_t *)ram_param);
   }
   QData *gprs = &top->io_gprs_0;
-  char name[15] = {};
-  size_t cpu_reg, diff_reg;
-  size_t diff_regs[50];
+  difftest_start(diff_async, diff_sweep);
 #endif
 
   setbuf(stdout, NULL);
@@ -82,20 +694,46 @@ int main(int argc, char **argv, char **env) {
 #ifdef TRACE
   contextp->traceEverOn(true);
   top->trace(tfp, 0);
-  tfp->open("dump.fst");
+  if (trace_window) trace_name_segments();
+#endif
+  bool restored = false;
+#ifdef CHECKPOINT
+  if (restore_file) {
+    checkpoint_restore(restore_file);
+    restored = true;
+  }
 #endif
-  top->reset = 1;
-  top->clock = 0;
-  top->eval();
 
-  for (int i = 0; i < 50; i++) {
-    contextp->timeInc(1);
-    top->clock = !top->clock;
+  if (!restored) {
+    top->reset = 1;
+    top->clock = 0;
     top->eval();
+
+    for (int i = 0; i < 50; i++) {
+      contextp->timeInc(1);
+      top->clock = !top->clock;
+      top->eval();
+    }
   }
 
   top->reset = 0;
+  const char *result = "finished";
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
   for (;!contextp->gotFinish();cycles++) {
+    if (server && cycles == server_boot * 2)
+      serve();
+#ifdef CHECKPOINT
+    if (ckpt_file && cycles == ckpt_cycle * 2)
+      checkpoint_save(ckpt_file);
+#endif
+    if (snapshot_interval && !server && cycles && cycles % (snapshot_interval * 2) == 0)
+      snapshot_take();
+    if (replaying && cycles > replay_end) {
+      printf(DEBUG "The replay went past the failure without failing.\n");
+      result = "replayed";
+      ret = 1;
+      break;
+    }
 #ifdef mainargs
     if (cycles == 246656526)
       command_init(to_string(mainargs) "\n");
@@ -103,83 +741,76 @@ int main(int argc, char **argv, char **env) {
     contextp->timeInc(1);
     top->clock = !top->clock;
     top->eval();
+    uart_poll();
+    virtio_poll();
     no_commit = top->io_wbValid ? 0 : no_commit + 1;
+    if (top->io_wbValid && top->clock) {
+      instrs++;
+      if (profile_interval)
+        profile_commit(top->io_wbPC, top->io_wbRd, (&top->io_gprs_0)[top->io_wbRd], top->io_wbRvc);
+      if (replaying)
+        printf("[%ld] pc = " FMT_WORD " x%d = " FMT_WORD "\n", cycles / 2, top->io_wbPC, top->io_wbRd,
+               (uint64_t)(&top->io_gprs_0)[top->io_wbRd]);
+    }
     if (no_commit > 1000000) {
       printf(DEBUG "Seems like stuck.\n");
-      real_int_handler();
+      real_int_handler("stuck");
+    }
+    if (max_cycles && cycles - base_cycles >= max_cycles * 2) {
+      console_flush();
+      printf(DEBUG "Gave up after %ld clock cycles at pc = " FMT_WORD ".\n", (cycles - base_cycles) / 2, top->io_wbPC);
+      result = "timeout";
+      ret = 3;
+      break;
     }
+    if (profile_interval && cycles % (profile_interval * 2) == 0)
+      profile_sample(top->io_wbPC);
 #ifdef TRACE
-    if (cycles >= 0)
-      tfp->dump(contextp->time());
+    if (!snapshot_interval && !server) trace_step();
 #endif
 
 #ifdef DIFFTEST
     if (top->io_wbValid && top->clock) {
-      pc = top->io_wbPC;
-      spike_pc = diff_gpr_pc.pc[0];
-      if (pc != spike_pc) {
-        strcpy(name, "pc");
-        cpu_reg = pc;
-        diff_reg = spike_pc;
-        goto reg_diff;
-      }
-      bool skip = top->io_wbIntr || top->io_exit || top->io_wbRcsr == 0x344 ||
-                  top->io_wbRcsr == 0xC01 || top->io_wbMMIO;
-      if (!skip) {
-        difftest_exec(1);
-        difftest_regcpy(diff_regs, DIFFTEST_TO_DUT);
-        add_diff(mtval);
-        add_diff(stval);
-        add_diff(mcause);
-        add_diff(scause);
-        add_diff(mepc);
-        add_diff(sepc);
-        add_diff(mstatus);
-        add_diff(mtvec);
-        add_diff(stvec);
-        add_diff(mie);
-        add_diff(mscratch);
-        add_diff(priv);
-        for (int i = 0; i < 32; i++) if (diff_regs[i] != gprs[i]) {
-          char tmp[10];
-          sprintf(tmp, "GPR[%d]", i);
-          strcpy(name, tmp);
-          cpu_reg = gprs[i];
-          diff_reg = diff_regs[i];
-          goto reg_diff;
-        }
-      } else {
-        if (skip && !top->io_wbIntr)
-          difftest_exec(1);
-        size_t tmp[50];
-        difftest_regcpy(tmp, DIFFTEST_TO_DUT);
-        memcpy(tmp, gprs, 32 * sizeof(size_t));
-        tmp[mstatus] = top->io_mstatus;
-        tmp[mepc] = top->io_mepc;
-        tmp[sepc] = top->io_sepc;
-        tmp[mtvec] = top->io_mtvec;
-        tmp[stvec] = top->io_stvec;
-        tmp[mcause] = top->io_mcause;
-        tmp[scause] = top->io_scause;
-        tmp[mtval] = top->io_mtval;
-        tmp[stval] = top->io_stval;
-        tmp[mie] = top->io_mie;
-        tmp[mscratch] = top->io_mscratch;
-        tmp[priv] = top->io_priv;
-        tmp[32] = top->io_wbIntr ? (top->io_priv == 0b11 ? tmp[mtvec] : tmp[stvec]) : pc + (top->io_wbRvc ? 2 : 4);
-        difftest_regcpy(tmp, DIFFTEST_TO_REF);
-      }
+      diff_commit_t *c = difftest_next();
+      c->cycle = cycles;
+      memcpy(c->regs, gprs, 32 * sizeof(size_t));
+      c->regs[pc]       = top->io_wbPC;
+      c->regs[mstatus]  = top->io_mstatus;
+      c->regs[mepc]     = top->io_mepc;
+      c->regs[sepc]     = top->io_sepc;
+      c->regs[mtvec]    = top->io_mtvec;
+      c->regs[stvec]    = top->io_stvec;
+      c->regs[mcause]   = top->io_mcause;
+      c->regs[scause]   = top->io_scause;
+      c->regs[mtval]    = top->io_mtval;
+      c->regs[stval]    = top->io_stval;
+      c->regs[mie]      = top->io_mie;
+      c->regs[mscratch] = top->io_mscratch;
+      c->regs[priv]     = top->io_priv;
+      c->skip = top->io_wbIntr || top->io_exit || top->io_wbRcsr == 0x344 ||
+                top->io_wbRcsr == 0xC01 || top->io_wbMMIO;
+      c->rd   = top->io_wbRd;
+      c->rcsr = top->io_wbRcsr;
+      c->intr = top->io_wbIntr;
+      c->rvc  = top->io_wbRvc;
+      if (difftest_commit()) goto reg_diff;
     }
+    if (top->io_exit && difftest_drain()) goto reg_diff;
 #endif
 
+    if (top->io_exit) console_flush();
     if (top->io_exit == 1) {
       printf(DEBUG "Exit after %ld clock cycles.\n", cycles / 2);
       printf(DEBUG);
       if (top->io_gprs_10) {
         printf("\33[1;31mHIT BAD TRAP");
+        result = "bad";
         ret = 1;
       }
-      else printf("\33[1;32mHIT GOOD TRAP");
+      else {
+        printf("\33[1;32mHIT GOOD TRAP");
+        result = "good";
+      }
       printf("\33[0m at pc = " FMT_WORD "\n\n", top->io_wbPC - 4);
       break;
     }
@@ -187,44 +818,37 @@ int main(int argc, char **argv, char **env) {
       printf(DEBUG "Exit after %ld clock cycles.\n", cycles / 2);
       printf(DEBUG "\33[1;31mINVALID INSTRUCTION");
       printf("\33[0m at pc = " FMT_WORD "\n\n", top->io_wbPC - 4);
+      result = "invalid";
       ret = 1;
       break;
     }
-    if (int_sig) real_int_handler();
+    if (int_sig) real_int_handler("interrupted");
 #ifdef DIFFTEST
     continue;
   reg_diff:
-    std::cout << DEBUG "Exit after " << cycles / 2 << " clock cycles.\n";
-    std::cout << DEBUG "\33[1;31m" << name << " Diff\33[0m ";
-    printf("at pc = " FMT_WORD "\n" DEBUG, pc);
-    printf("pc = " FMT_WORD "\tspike_pc = " FMT_WORD "\n", pc, diff_regs[32]);
-    for (int i = 0; i < 32; i++)
-      printf("GPR[%d] = " FMT_WORD "\tspike_GPR[%d] = " FMT_WORD "\n", i, gprs[i], i, diff_regs[i]);
-    print_csr(mstatus);
-    print_csr(mtval);
-    print_csr(stval);
-    print_csr(mcause);
-    print_csr(scause);
-    print_csr(mepc);
-    print_csr(sepc);
-    print_csr(mstatus);
-    print_csr(mtvec);
-    print_csr(stvec);
-    print_csr(mie);
-    print_csr(mscratch);
-    print_csr(priv);
+    console_flush();
+    difftest_report();
+    result = "diff";
     ret = 1;
     break;
 #endif
   }
 
-  scan_uart(_isRunning) = false;
+#ifdef DIFFTEST
+  difftest_stop();
+#endif
+  dram_report();
+  perf_report();
+  stats_write(result);
+  profile_write();
   delete top;
   tcsetattr(0, TCSAFLUSH, &stored_settings);
   setlinebuf(stdout);
   setlinebuf(stderr);
+  bool failed = strcmp(result, "good") && strcmp(result, "finished") && strcmp(result, "timeout");
 #ifdef TRACE
-  tfp->close();
+  trace_finish(failed);
 #endif
+  snapshot_finish(failed);
   return ret;
 }
@@ -25,7 +25,7 @@ void real_int_handler(void) {
   tcsetattr(0, TCSAFLUSH, &stored_settings);
   setlinebuf(stdout);
   setlinebuf(stderr);
-  scan_uart(_isRunning) = false;
+  console_flush();
 #ifdef TRACE
   tfp->close();
 #endif
@@ -33,6 +33,15 @@ void real_int_handler(void) {
   exit(0);
 }
 
+#ifdef DIFFTEST
+// difftest here runs in lockstep, so DMA writes can go to the REF right away
+void difftest_dma(uint64_t addr, void *buf, size_t n) {
+  if (addr < 0x80000000UL || addr - 0x80000000UL >= DIFF_PMEM_SIZE) return;
+  if (n > DIFF_PMEM_SIZE - (addr - 0x80000000UL)) n = DIFF_PMEM_SIZE - (addr - 0x80000000UL);
+  difftest_memcpy(addr, buf, n, DIFFTEST_TO_REF);
+}
+#endif
+
 int main(int argc, char **argv, char **env) {
   top = new VCorvusTopWrapper;
 
@@ -40,7 +49,9 @@ int main(int argc, char **argv, char **env) {
   void *ram_param =
 #endif
   ram_init(argv[1]);
+  dram_init();
   sdcard_init(argv[1]);
+  virtio_init();
 
 #ifdef FLASH
   flash_init(argv[2]);
@@ -58,7 +69,7 @@ int main(int argc, char **argv, char **env) {
     difftest_regcpy(tmp, DIFFTEST_TO_DUT);
     tmp[32] = 0x80000000UL;
     difftest_regcpy(tmp, DIFFTEST_TO_REF);
-    difftest_memcpy(0x80000000UL, ram_param, PMEM_SIZE, DIFFTEST_TO_REF);
+    difftest_memcpy(0x80000000UL, ram_param, DIFF_PMEM_SIZE, DIFFTEST_TO_REF);
   }
   QData *gprs = &top->io_gprs_0;
   char name[15] = {};
@@ -103,6 +114,8 @@ int main(int argc, char **argv, char **env) {
     // contextp->timeInc(1);
     top->clock = !top->clock;
     top->eval();
+    uart_poll();
+    virtio_poll();
     no_commit = top->io_wbValid ? 0 : no_commit + 1;
     if (no_commit > 1000000) {
       printf(DEBUG "Seems like stuck.\n");
@@ -172,6 +185,7 @@ int main(int argc, char **argv, char **env) {
     }
 #endif
 
+    if (top->io_exit) console_flush();
     if (top->io_exit == 1) {
       printf(DEBUG "Exit after %ld clock cycles.\n", cycles / 2);
       printf(DEBUG);
@@ -194,6 +208,7 @@ int main(int argc, char **argv, char **env) {
 #ifdef DIFFTEST
     continue;
   reg_diff:
+    console_flush();
     std::cout << DEBUG "Exit after " << cycles / 2 << " clock cycles.\n";
     std::cout << DEBUG "\33[1;31m" << name << " Diff\33[0m ";
     printf("at pc = " FMT_WORD "\n" DEBUG, pc);
@@ -218,7 +233,6 @@ int main(int argc, char **argv, char **env) {
 #endif
   }
 
-  scan_uart(_isRunning) = false;
   delete top;
   tcsetattr(0, TCSAFLUSH, &stored_settings);
   setlinebuf(stdout);
@@ -5,8 +5,12 @@ _CORVUS_USER_INCLUDE_FLAGS = -I$(YQ_DIR)/sim/include
 _CORVUS_USER_MACRO_FLAGS = -DDIFFTEST
 _CORVUS_USER_LIB_FLAGS = -L$(LIB_DIR) -lrv64spike
 _CORVUS_USER_SRC_FILES = $(YQ_DIR)/sim/src/peripheral/uart/uart.cpp \
+				         $(YQ_DIR)/sim/src/peripheral/uart/console.cpp \
 				         $(YQ_DIR)/sim/src/peripheral/sdcard/sdcard.cpp \
+				         $(YQ_DIR)/sim/src/peripheral/virtio/virtio.cpp \
+				         $(YQ_DIR)/sim/src/peripheral/dmac/dmac.cpp \
 				         $(YQ_DIR)/sim/src/peripheral/ram/ram.cpp \
+				         $(YQ_DIR)/sim/src/peripheral/ram/dram.cpp \
 				         $(YQ_DIR)/sim/src/peripheral/spiFlash/spiFlash.cpp
 _CORVUS_MAIN_SRC = $(YQ_DIR)/sim/src/sim_main_corvus.cpp
 _CORVUS_TARGET = sim_main_corvus
@@ -26,4 +26,5 @@ class DEBUG(implicit val p: Parameters) extends Bundle with UtilsParams {
   val stval    = Output(UInt(xlen.W))
   val mie      = Output(UInt(xlen.W))
   val mscratch = Output(UInt(xlen.W))
+  val perf     = new PERF
 }
@@ -0,0 +1,34 @@
+package utils
+
+import chisel3._
+
+// Performance counters, counted from reset. Each cycle lands in exactly one
+// of the cpi* counters; see CPU for how it is picked. A stage's *Stall counts
+// the cycles it held off a valid instruction from the stage before it.
+class PERF extends Bundle {
+  val cycles       = Output(UInt(64.W))
+  val instrs       = Output(UInt(64.W))
+  val icacheHit    = Output(UInt(64.W))
+  val icacheMiss   = Output(UInt(64.W))
+  val dcacheHit    = Output(UInt(64.W))
+  val dcacheMiss   = Output(UInt(64.W))
+  val dcacheWb     = Output(UInt(64.W))
+  val itlbMiss     = Output(UInt(64.W))
+  val dtlbMiss     = Output(UInt(64.W))
+  val tlbWalk      = Output(UInt(64.W))
+  val idStall      = Output(UInt(64.W))
+  val exStall      = Output(UInt(64.W))
+  val memStall     = Output(UInt(64.W))
+  val wbStall      = Output(UInt(64.W))
+  val loadUse      = Output(UInt(64.W))
+  val mulBusy      = Output(UInt(64.W))
+  val divBusy      = Output(UInt(64.W))
+  val cpiBase      = Output(UInt(64.W))
+  val cpiMemory    = Output(UInt(64.W))
+  val cpiMulDiv    = Output(UInt(64.W))
+  val cpiExecute   = Output(UInt(64.W))
+  val cpiLoadUse   = Output(UInt(64.W))
+  val cpiDepend    = Output(UInt(64.W))
+  val cpiFrontend  = Output(UInt(64.W))
+  val cpiOther     = Output(UInt(64.W))
+}
@@ -13,6 +13,8 @@ abstract trait SpiSlaveIOTrait extends UtilsParams {
   val spi_cs      = Input (Bool())
   val spi_mosi    = Input (UInt(1.W))
   val spi_miso    = Output(UInt(1.W))
+  val spi_qmosi   = Input (UInt(4.W)) // IO[3:0] in dual and quad phases
+  val spi_qmiso   = Output(UInt(4.W))
   val spi_irq_out = Input (Bool())
 }
 
@@ -21,5 +23,7 @@ abstract trait SpiMasterIOTrait extends UtilsParams {
   val spi_cs      = Output(Bool())
   val spi_mosi    = Output(UInt(1.W))
   val spi_miso    = Input (UInt(1.W))
+  val spi_qmosi   = Output(UInt(4.W)) // IO[3:0] in dual and quad phases
+  val spi_qmiso   = Input (UInt(4.W))
   val spi_irq_out = Output(Bool())
 }